@@ -0,0 +1,618 @@
+#include "bimap.h"
+#include "frozen-bimap.h"
+#include "small-bimap.h"
+#include <algorithm> // std::shuffle, std::sort
+#include <benchmark/benchmark.h>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef BIMAP_BENCH_BOOST
+#include <boost/bimap.hpp>
+#endif
+
+#ifndef BIMAP_BENCH_MAX_SIZE
+#define BIMAP_BENCH_MAX_SIZE 1000000
+#endif
+
+namespace {
+
+// Keys are distinct images of 0, 1, 2, ... under a bijection, so the
+// sequences for every seed are duplicate-free and reproducible.
+std::uint64_t mix(std::uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+template <typename K>
+K make_key(std::uint64_t i, std::uint64_t seed);
+
+template <>
+int make_key<int>(std::uint64_t i, std::uint64_t seed) {
+    // odd multiplier: a bijection on 32 bits
+    return static_cast<int>(
+        static_cast<std::uint32_t>(i * 2654435761u + seed * 0x9e3779b9u));
+}
+
+template <>
+std::uint64_t make_key<std::uint64_t>(std::uint64_t i, std::uint64_t seed) {
+    return mix(i ^ (seed << 56));
+}
+
+// longer than the small string buffer, as real identifiers are
+template <>
+std::string make_key<std::string>(std::uint64_t i, std::uint64_t seed) {
+    return "key:" + std::to_string(seed) + ":" + std::to_string(mix(i));
+}
+
+template <typename K>
+struct data_set {
+    std::vector<K> left;
+    std::vector<K> right;
+    // left[order[i]] is probed i-th, so lookups do not follow the tree order
+    std::vector<std::size_t> order;
+
+    explicit data_set(std::size_t n) : left(n), right(n), order(n) {
+        for (std::size_t i = 0; i < n; i++) {
+            left[i] = make_key<K>(i, 1);
+            right[i] = make_key<K>(i, 2);
+            order[i] = i;
+        }
+        std::mt19937_64 rng(n);
+        std::shuffle(order.begin(), order.end(), rng);
+    }
+};
+
+// Uniform face over the measured containers. Lookups return a pointer to
+// the found key or nullptr, so that nothing is copied in the timed loop.
+template <typename K>
+struct bimap_impl {
+    bimap<K, K> m;
+
+    void insert(K const& a, K const& b) {
+        m.insert(a, b);
+    }
+
+    K const* find_left(K const& key) const {
+        auto it = m.find_left(key);
+        return it == m.end_left() ? nullptr : &*it;
+    }
+
+    K const* find_right(K const& key) const {
+        auto it = m.find_right(key);
+        return it == m.end_right() ? nullptr : &*it;
+    }
+
+    K const& at_left(K const& key) const {
+        return m.at_left(key);
+    }
+
+    K const& at_right(K const& key) const {
+        return m.at_right(key);
+    }
+
+    K const* lower_bound_left(K const& key) const {
+        auto it = m.lower_bound_left(key);
+        return it == m.end_left() ? nullptr : &*it;
+    }
+
+    K const* lower_bound_right(K const& key) const {
+        auto it = m.lower_bound_right(key);
+        return it == m.end_right() ? nullptr : &*it;
+    }
+
+    template <typename F>
+    void for_each_left(F f) const {
+        for (auto it = m.begin_left(); it != m.end_left(); ++it) {
+            f(*it);
+        }
+    }
+
+    template <typename F>
+    void visit_left(F f) const {
+        m.for_each_left([&](K const& key, K const&) { f(key); });
+    }
+
+    bool erase_left(K const& key) {
+        return m.erase_left(key);
+    }
+
+    bool erase_right(K const& key) {
+        return m.erase_right(key);
+    }
+};
+
+// The usual replacement: two maps kept in sync by hand.
+template <typename K>
+struct map_impl {
+    std::map<K, K> left;
+    std::map<K, K> right;
+
+    void insert(K const& a, K const& b) {
+        if (left.find(a) != left.end() || right.find(b) != right.end()) {
+            return;
+        }
+        left.emplace(a, b);
+        right.emplace(b, a);
+    }
+
+    K const* find_left(K const& key) const {
+        auto it = left.find(key);
+        return it == left.end() ? nullptr : &it->first;
+    }
+
+    K const* find_right(K const& key) const {
+        auto it = right.find(key);
+        return it == right.end() ? nullptr : &it->first;
+    }
+
+    K const& at_left(K const& key) const {
+        return left.at(key);
+    }
+
+    K const& at_right(K const& key) const {
+        return right.at(key);
+    }
+
+    K const* lower_bound_left(K const& key) const {
+        auto it = left.lower_bound(key);
+        return it == left.end() ? nullptr : &it->first;
+    }
+
+    K const* lower_bound_right(K const& key) const {
+        auto it = right.lower_bound(key);
+        return it == right.end() ? nullptr : &it->first;
+    }
+
+    template <typename F>
+    void for_each_left(F f) const {
+        for (auto const& p : left) {
+            f(p.first);
+        }
+    }
+
+    template <typename F>
+    void visit_left(F f) const {
+        for_each_left(f);
+    }
+
+    bool erase_left(K const& key) {
+        auto it = left.find(key);
+        if (it == left.end()) {
+            return false;
+        }
+        right.erase(it->second);
+        left.erase(it);
+        return true;
+    }
+
+    bool erase_right(K const& key) {
+        auto it = right.find(key);
+        if (it == right.end()) {
+            return false;
+        }
+        left.erase(it->second);
+        right.erase(it);
+        return true;
+    }
+};
+
+#ifdef BIMAP_BENCH_BOOST
+template <typename K>
+struct boost_impl {
+    using container = boost::bimaps::bimap<K, K>;
+    container m;
+
+    void insert(K const& a, K const& b) {
+        m.insert(typename container::value_type(a, b));
+    }
+
+    K const* find_left(K const& key) const {
+        auto it = m.left.find(key);
+        return it == m.left.end() ? nullptr : &it->first;
+    }
+
+    K const* find_right(K const& key) const {
+        auto it = m.right.find(key);
+        return it == m.right.end() ? nullptr : &it->first;
+    }
+
+    K const& at_left(K const& key) const {
+        return m.left.at(key);
+    }
+
+    K const& at_right(K const& key) const {
+        return m.right.at(key);
+    }
+
+    K const* lower_bound_left(K const& key) const {
+        auto it = m.left.lower_bound(key);
+        return it == m.left.end() ? nullptr : &it->first;
+    }
+
+    K const* lower_bound_right(K const& key) const {
+        auto it = m.right.lower_bound(key);
+        return it == m.right.end() ? nullptr : &it->first;
+    }
+
+    template <typename F>
+    void for_each_left(F f) const {
+        for (auto const& p : m.left) {
+            f(p.first);
+        }
+    }
+
+    template <typename F>
+    void visit_left(F f) const {
+        for_each_left(f);
+    }
+
+    bool erase_left(K const& key) {
+        return m.left.erase(key) != 0;
+    }
+
+    bool erase_right(K const& key) {
+        return m.right.erase(key) != 0;
+    }
+};
+#endif
+
+template <typename Impl, typename K>
+void fill(Impl& c, data_set<K> const& data) {
+    for (std::size_t i = 0; i < data.left.size(); i++) {
+        c.insert(data.left[i], data.right[i]);
+    }
+}
+
+template <typename Impl, typename K>
+void bm_insert(benchmark::State& state) {
+    data_set<K> data(state.range(0));
+    for (auto _ : state) {
+        std::optional<Impl> c(std::in_place);
+        fill(*c, data);
+        benchmark::DoNotOptimize(&*c);
+        state.PauseTiming();
+        c.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// One lookup per iteration, cycling through the probes. Lookup(c, data, i)
+// probes with the i-th key.
+template <typename Impl, typename K, typename Lookup>
+void run_lookups(benchmark::State& state, Lookup lookup) {
+    data_set<K> data(state.range(0));
+    Impl c;
+    fill(c, data);
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(lookup(c, data, data.order[i]));
+        if (++i == data.order.size()) {
+            i = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename Impl, typename K>
+void bm_find_left(benchmark::State& state) {
+    run_lookups<Impl, K>(state, [](Impl const& c, data_set<K> const& d,
+        std::size_t i) { return c.find_left(d.left[i]); });
+}
+
+template <typename Impl, typename K>
+void bm_find_right(benchmark::State& state) {
+    run_lookups<Impl, K>(state, [](Impl const& c, data_set<K> const& d,
+        std::size_t i) { return c.find_right(d.right[i]); });
+}
+
+template <typename Impl, typename K>
+void bm_at_left(benchmark::State& state) {
+    run_lookups<Impl, K>(state, [](Impl const& c, data_set<K> const& d,
+        std::size_t i) { return &c.at_left(d.left[i]); });
+}
+
+template <typename Impl, typename K>
+void bm_at_right(benchmark::State& state) {
+    run_lookups<Impl, K>(state, [](Impl const& c, data_set<K> const& d,
+        std::size_t i) { return &c.at_right(d.right[i]); });
+}
+
+template <typename Impl, typename K>
+void bm_lower_bound_left(benchmark::State& state) {
+    run_lookups<Impl, K>(state, [](Impl const& c, data_set<K> const& d,
+        std::size_t i) { return c.lower_bound_left(d.left[i]); });
+}
+
+template <typename Impl, typename K>
+void bm_lower_bound_right(benchmark::State& state) {
+    run_lookups<Impl, K>(state, [](Impl const& c, data_set<K> const& d,
+        std::size_t i) { return c.lower_bound_right(d.right[i]); });
+}
+
+template <typename Impl, typename K>
+void bm_iterate(benchmark::State& state) {
+    data_set<K> data(state.range(0));
+    Impl c;
+    fill(c, data);
+    for (auto _ : state) {
+        std::size_t count = 0;
+        c.for_each_left([&](K const& key) {
+            benchmark::DoNotOptimize(&key);
+            count++;
+            });
+        benchmark::DoNotOptimize(count);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// bimap walks through for_each_left, the others have no visitor and
+// iterate as in bm_iterate
+template <typename Impl, typename K>
+void bm_visit(benchmark::State& state) {
+    data_set<K> data(state.range(0));
+    Impl c;
+    fill(c, data);
+    for (auto _ : state) {
+        std::size_t count = 0;
+        c.visit_left([&](K const& key) {
+            benchmark::DoNotOptimize(&key);
+            count++;
+            });
+        benchmark::DoNotOptimize(count);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Erases every pair by its key on one side, in probe order.
+template <typename Impl, typename K, bool Left>
+void run_erase(benchmark::State& state) {
+    data_set<K> data(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::optional<Impl> c(std::in_place);
+        fill(*c, data);
+        state.ResumeTiming();
+        for (auto i : data.order) {
+            if constexpr (Left) {
+                benchmark::DoNotOptimize(c->erase_left(data.left[i]));
+            }
+            else {
+                benchmark::DoNotOptimize(c->erase_right(data.right[i]));
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <typename Impl, typename K>
+void bm_erase_left(benchmark::State& state) {
+    run_erase<Impl, K, true>(state);
+}
+
+template <typename Impl, typename K>
+void bm_erase_right(benchmark::State& state) {
+    run_erase<Impl, K, false>(state);
+}
+
+template <typename Impl, typename K>
+void bm_copy(benchmark::State& state) {
+    data_set<K> data(state.range(0));
+    Impl c;
+    fill(c, data);
+    for (auto _ : state) {
+        std::optional<Impl> copy(c);
+        benchmark::DoNotOptimize(&*copy);
+        state.PauseTiming();
+        copy.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <typename Impl, typename K>
+void bm_destroy(benchmark::State& state) {
+    data_set<K> data(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::optional<Impl> c(std::in_place);
+        fill(*c, data);
+        state.ResumeTiming();
+        c.reset();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// bimap only: bulk build from pairs sorted by left, and copy, with
+// state.range(1) threads (0 -- all cores)
+template <typename K>
+void bm_parallel_build(benchmark::State& state) {
+    data_set<K> data(state.range(0));
+    std::vector<std::pair<K, K>> pairs;
+    pairs.reserve(data.left.size());
+    for (std::size_t i = 0; i < data.left.size(); i++) {
+        pairs.emplace_back(data.left[i], data.right[i]);
+    }
+    std::sort(pairs.begin(), pairs.end());
+    parallel::policy policy{ static_cast<unsigned>(state.range(1)) };
+    for (auto _ : state) {
+        std::optional<bimap<K, K>> c(
+            bimap<K, K>::from_sorted(policy, pairs.begin(), pairs.end()));
+        benchmark::DoNotOptimize(&*c);
+        state.PauseTiming();
+        c.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <typename K>
+void bm_parallel_copy(benchmark::State& state) {
+    data_set<K> data(state.range(0));
+    bimap_impl<K> c;
+    fill(c, data);
+    parallel::policy policy{ static_cast<unsigned>(state.range(1)) };
+    for (auto _ : state) {
+        std::optional<bimap<K, K>> copy(std::in_place, policy, c.m);
+        benchmark::DoNotOptimize(&*copy);
+        state.PauseTiming();
+        copy.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// tiny maps: small_bimap against bimap, both filled with n < 16 pairs
+template <typename K>
+using small_of = small_bimap<K, K>;
+
+template <typename K>
+using bimap_of = bimap<K, K>;
+
+template <typename Map, typename K>
+void bm_tiny_find_left(benchmark::State& state) {
+    data_set<K> data(state.range(0));
+    Map c;
+    for (std::size_t i = 0; i < data.left.size(); i++) {
+        c.insert(data.left[i], data.right[i]);
+    }
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(&*c.find_left(data.left[data.order[i]]));
+        if (++i == data.order.size()) {
+            i = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// frozen_bimap only: std::less on integral keys selects the SIMD B-tree
+// when the target has it, this equivalent comparator of another type
+// keeps the scalar Eytzinger index for comparison
+template <typename K>
+struct eytzinger_less : std::less<K> {};
+
+template <typename K, typename Compare, typename Lookup>
+void run_frozen_lookups(benchmark::State& state, Lookup lookup) {
+    data_set<K> data(state.range(0));
+    std::vector<std::pair<K, K>> pairs;
+    pairs.reserve(data.left.size());
+    for (std::size_t i = 0; i < data.left.size(); i++) {
+        pairs.emplace_back(data.left[i], data.right[i]);
+    }
+    std::sort(pairs.begin(), pairs.end(),
+        [](auto const& a, auto const& b) { return a.first < b.first; });
+    auto c = frozen_bimap<K, K, Compare>::from_sorted(pairs.begin(), pairs.end());
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(&*lookup(c, data.left[data.order[i]]));
+        if (++i == data.order.size()) {
+            i = 0;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename K, typename Compare>
+void bm_frozen_find_left(benchmark::State& state) {
+    run_frozen_lookups<K, Compare>(state,
+        [](auto const& c, K const& key) { return c.find_left(key); });
+}
+
+template <typename K, typename Compare>
+void bm_frozen_lower_bound_left(benchmark::State& state) {
+    run_frozen_lookups<K, Compare>(state,
+        [](auto const& c, K const& key) { return c.lower_bound_left(key); });
+}
+
+void sizes(benchmark::internal::Benchmark* b) {
+    for (std::int64_t n = 1000; n <= BIMAP_BENCH_MAX_SIZE; n *= 10) {
+        b->Arg(n);
+    }
+}
+
+void parallel_sizes(benchmark::internal::Benchmark* b) {
+    for (std::int64_t n = 1000; n <= BIMAP_BENCH_MAX_SIZE; n *= 10) {
+        b->Args({ n, 1 });
+        b->Args({ n, 0 });
+    }
+}
+
+} // namespace
+
+// Whole-container operations report milliseconds, single lookups the
+// default nanoseconds.
+#define BIMAP_BENCHMARK_ONE(op, impl, key, unit)                               \
+    BENCHMARK_TEMPLATE(op, impl<key>, key)->Apply(sizes)->Unit(unit);
+
+#define BIMAP_BENCHMARK_KEYS(op, impl, unit)                                   \
+    BIMAP_BENCHMARK_ONE(op, impl, int, unit)                                   \
+    BIMAP_BENCHMARK_ONE(op, impl, std::uint64_t, unit)                         \
+    BIMAP_BENCHMARK_ONE(op, impl, std::string, unit)
+
+#ifdef BIMAP_BENCH_BOOST
+#define BIMAP_BENCHMARK_BOOST(op, unit) BIMAP_BENCHMARK_KEYS(op, boost_impl, unit)
+#else
+#define BIMAP_BENCHMARK_BOOST(op, unit)
+#endif
+
+#define BIMAP_BENCHMARK(op, unit)                                              \
+    BIMAP_BENCHMARK_KEYS(op, bimap_impl, unit)                                 \
+    BIMAP_BENCHMARK_KEYS(op, map_impl, unit)                                   \
+    BIMAP_BENCHMARK_BOOST(op, unit)
+
+BIMAP_BENCHMARK(bm_insert, benchmark::kMillisecond)
+BIMAP_BENCHMARK(bm_find_left, benchmark::kNanosecond)
+BIMAP_BENCHMARK(bm_find_right, benchmark::kNanosecond)
+BIMAP_BENCHMARK(bm_at_left, benchmark::kNanosecond)
+BIMAP_BENCHMARK(bm_at_right, benchmark::kNanosecond)
+BIMAP_BENCHMARK(bm_lower_bound_left, benchmark::kNanosecond)
+BIMAP_BENCHMARK(bm_lower_bound_right, benchmark::kNanosecond)
+BIMAP_BENCHMARK(bm_iterate, benchmark::kMillisecond)
+BIMAP_BENCHMARK(bm_visit, benchmark::kMillisecond)
+BIMAP_BENCHMARK(bm_erase_left, benchmark::kMillisecond)
+BIMAP_BENCHMARK(bm_erase_right, benchmark::kMillisecond)
+BIMAP_BENCHMARK(bm_copy, benchmark::kMillisecond)
+BIMAP_BENCHMARK(bm_destroy, benchmark::kMillisecond)
+
+#define BIMAP_BENCHMARK_PARALLEL_ONE(op, key)                                  \
+    BENCHMARK_TEMPLATE(op, key)                                                \
+        ->Apply(parallel_sizes)                                                \
+        ->Unit(benchmark::kMillisecond);
+
+#define BIMAP_BENCHMARK_PARALLEL(op)                                           \
+    BIMAP_BENCHMARK_PARALLEL_ONE(op, int)                                      \
+    BIMAP_BENCHMARK_PARALLEL_ONE(op, std::string)
+
+#define BIMAP_BENCHMARK_TINY(map, key)                                         \
+    BENCHMARK_TEMPLATE(bm_tiny_find_left, map, key)->Arg(4)->Arg(8)->Arg(15);
+
+BIMAP_BENCHMARK_TINY(small_of<int>, int)
+BIMAP_BENCHMARK_TINY(bimap_of<int>, int)
+BIMAP_BENCHMARK_TINY(small_of<std::string>, std::string)
+BIMAP_BENCHMARK_TINY(bimap_of<std::string>, std::string)
+
+#define BIMAP_BENCHMARK_FROZEN_ONE(op, key)                                    \
+    BENCHMARK_TEMPLATE(op, key, std::less<key>)->Apply(sizes);                 \
+    BENCHMARK_TEMPLATE(op, key, eytzinger_less<key>)->Apply(sizes);
+
+#define BIMAP_BENCHMARK_FROZEN(op)                                             \
+    BIMAP_BENCHMARK_FROZEN_ONE(op, int)                                        \
+    BIMAP_BENCHMARK_FROZEN_ONE(op, std::uint64_t)                              \
+    BIMAP_BENCHMARK_FROZEN_ONE(op, std::string)
+
+BIMAP_BENCHMARK_FROZEN(bm_frozen_find_left)
+BIMAP_BENCHMARK_FROZEN(bm_frozen_lower_bound_left)
+
+BIMAP_BENCHMARK_PARALLEL(bm_parallel_build)
+BIMAP_BENCHMARK_PARALLEL(bm_parallel_copy)
+
+BENCHMARK_MAIN();
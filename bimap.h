@@ -1,22 +1,43 @@
 #pragma once
 
+#include "intrusive-hash-set.h"
 #include "intrusive-set.h"
-#include <cassert>  // assert
+#include "parallel-build.h"
+#include <algorithm> // std::sort
+#include <cassert>   // assert
+#include <cstdint>
 #include <iterator> // std::reverse_iterator
+#include <memory>   // std::allocator_traits
+#include <optional>
 #include <random>
-#include <utility> // std::pair, std::swap
+#include <span>
+#include <stdexcept>
+#include <tuple> // std::forward_as_tuple, std::make_from_tuple
+#include <type_traits>
+#include <utility> // std::pair, std::swap, std::exchange
+#include <vector>
 
-template <typename Left, typename Right, typename CompareLeft = std::less<Left>, 
-    typename CompareRight = std::less<Right>>
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+    typename CompareRight = std::less<Right>,
+    typename Allocator = std::allocator<std::pair<Left, Right>>>
 struct bimap {
 
 private:
+    // мелкие тривиально копируемые ключи передаются по значению
+    template <class K>
+    using key_arg = intrusive::key_arg_t<K>;
+
     template <class T, class Type>
     struct base_element {
         T elem;
 
         explicit base_element(T const& elem) : elem(elem) {}
         explicit base_element(T&& elem) : elem(std::move(elem)) {}
+
+        template <class... Args>
+        explicit base_element(std::piecewise_construct_t,
+            std::tuple<Args...> args)
+            : elem(std::make_from_tuple<T>(std::move(args))) {}
     };
 
 public:
@@ -24,31 +45,108 @@ public:
     using right_t = base_element<Right, struct r_tmp>;
 
 private:
-    struct root_pair : intrusive::set_element<struct left_tag>,
-        intrusive::set_element<struct right_tag> {
+    // Сторона упорядочена деревом, если на месте компаратора стоит
+    // компаратор, и хеширована, если intrusive::hashed<Hash, KeyEqual>:
+    // тогда у нее нет lower_bound/upper_bound, а обход идет в порядке
+    // таблицы. intrusive::ranked<Compare> -- дерево, которое хранит размеры
+    // поддеревьев и умеет nth/rank/count.
+    template <typename Key, typename Policy, typename Tag>
+    struct side {
+        using hook = intrusive::set_element<Tag>;
+        template <typename U, typename T>
+        using index = intrusive::set<U, T, Key, Tag, Policy>;
+        static constexpr bool ordered = true;
+        static constexpr bool ranked = false;
+    };
+
+    template <typename Key, typename Compare, typename Tag>
+    struct side<Key, intrusive::ranked<Compare>, Tag> {
+        using hook = intrusive::ranked_set_element<Tag>;
+        template <typename U, typename T>
+        using index =
+            intrusive::set<U, T, Key, Tag, intrusive::ranked<Compare>>;
+        static constexpr bool ordered = true;
+        static constexpr bool ranked = true;
+    };
+
+    template <typename Key, typename Hash, typename KeyEqual, typename Tag>
+    struct side<Key, intrusive::hashed<Hash, KeyEqual>, Tag> {
+        using hook = intrusive::hash_element<Tag>;
+        template <typename U, typename T>
+        using index = intrusive::hash_set<U, T, Key, Tag,
+            intrusive::hashed<Hash, KeyEqual>, Allocator>;
+        static constexpr bool ordered = false;
+        static constexpr bool ranked = false;
+    };
+
+    using left_side = side<Left, CompareLeft, struct left_tag>;
+    using right_side = side<Right, CompareRight, struct right_tag>;
+    using left_hook = typename left_side::hook;
+    using right_hook = typename right_side::hook;
+
+    static_assert(left_side::ordered || right_side::ordered,
+        "bimap: at least one side must be ordered");
+
+    struct root_pair : left_hook, right_hook {
         root_pair() = default;
     };
 
-    struct pair : root_pair, left_t, right_t {
-        explicit pair(Left l, Right r)
-            : left_t(std::move(l)), right_t(std::move(r)) {}
+    // приоритет один на оба дерева, у корня его нет
+    struct pair : root_pair, left_t, right_t, intrusive::set_priority {
+        template <class L, class R>
+        pair(L&& l, R&& r)
+            : left_t(std::piecewise_construct,
+                std::forward_as_tuple(std::forward<L>(l))),
+            right_t(std::piecewise_construct,
+                std::forward_as_tuple(std::forward<R>(r))) {}
+
+        template <class... LArgs, class... RArgs>
+        pair(std::piecewise_construct_t, std::tuple<LArgs...> l,
+            std::tuple<RArgs...> r)
+            : left_t(std::piecewise_construct, std::move(l)),
+            right_t(std::piecewise_construct, std::move(r)) {}
         pair() = default;
     };
 
 public:
     using node_t = pair;
+    using allocator_type = Allocator;
 
 private:
-    intrusive::set<node_t, left_t, Left, left_tag, CompareLeft> l;
-    intrusive::set<node_t, right_t, Right, right_tag, CompareRight> r;
+    using node_allocator =
+        typename std::allocator_traits<Allocator>::template rebind_alloc<node_t>;
+    using node_traits = std::allocator_traits<node_allocator>;
+
+    using left_set = typename left_side::template index<node_t, left_t>;
+    using right_set = typename right_side::template index<node_t, right_t>;
+
+    // до l и r: хеш-сторона пишет в свой корень в конструкторе
     root_pair root;
+    left_set l;
+    right_set r;
     size_t size_{ 0 };
+    [[no_unique_address]] node_allocator alloc;
+#ifdef BIMAP_STATS
+    std::size_t allocations{ 0 };
+    std::size_t deallocations{ 0 };
+#endif
 
 public:
-    template <class T, class Base, class Tag, class Compare, class OtherT,
-        class OtherBase, class OtherTag, class OtherCompare>
+    template <class T, class Base, class Hook, class Index, class OtherT,
+        class OtherBase, class OtherHook, class OtherIndex>
     struct bimap_iterator {
-        using iterator_category = std::bidirectional_iterator_tag;
+    private:
+        static constexpr bool ordered =
+            requires(Hook * ptr) { Index::get_prev(ptr); };
+        // по стороне с размерами поддеревьев сдвиг и расстояние за O(log n)
+        static constexpr bool random =
+            requires(Hook * ptr) { Index::rank_of(ptr); };
+
+    public:
+        using iterator_category = std::conditional_t<random,
+            std::random_access_iterator_tag,
+            std::conditional_t<ordered, std::bidirectional_iterator_tag,
+            std::forward_iterator_tag>>;
         using difference_type = std::ptrdiff_t;
         using value_type = Base const;
         using pointer = Base const*;
@@ -65,9 +163,7 @@ public:
         }
 
         bimap_iterator& operator++() {
-            it = static_cast<intrusive::set_element<Tag>*>(
-                intrusive::set<node_t, Base, Tag, Compare>::get_next(
-                    static_cast<intrusive::set_element_base*>(it)));
+            it = static_cast<Hook*>(Index::get_next(it));
             return *this;
         }
 
@@ -77,26 +173,67 @@ public:
             return old;
         }
 
-        bimap_iterator& operator--() {
-            it = static_cast<intrusive::set_element<Tag>*>(
-                intrusive::set<node_t, Base, Tag, Compare>::get_prev(
-                    static_cast<intrusive::set_element_base*>(it)));
+        bimap_iterator& operator--()
+            requires ordered {
+            it = static_cast<Hook*>(Index::get_prev(it));
             return *this;
         }
 
-        bimap_iterator operator--(int) {
+        bimap_iterator operator--(int)
+            requires ordered {
             bimap_iterator old = *this;
             --(*this);
             return old;
         }
 
-        bimap_iterator<OtherT, OtherBase, OtherTag, OtherCompare, T, Base, Tag,
-            Compare>
+        bimap_iterator& operator+=(difference_type n)
+            requires random {
+            it = static_cast<Hook*>(Index::advance(it, n));
+            return *this;
+        }
+
+        bimap_iterator& operator-=(difference_type n)
+            requires random {
+            return *this += -n;
+        }
+
+        friend bimap_iterator operator+(bimap_iterator a, difference_type n)
+            requires random {
+            return a += n;
+        }
+
+        friend bimap_iterator operator+(difference_type n, bimap_iterator a)
+            requires random {
+            return a += n;
+        }
+
+        friend bimap_iterator operator-(bimap_iterator a, difference_type n)
+            requires random {
+            return a -= n;
+        }
+
+        friend difference_type operator-(bimap_iterator const& a,
+            bimap_iterator const& b)
+            requires random {
+            return static_cast<difference_type>(Index::rank_of(a.it)) -
+                static_cast<difference_type>(Index::rank_of(b.it));
+        }
+
+        reference operator[](difference_type n) const
+            requires random {
+            return *(*this + n);
+        }
+
+        auto operator<=>(bimap_iterator const& other) const
+            requires random {
+            return Index::rank_of(it) <=> Index::rank_of(other.it);
+        }
+
+        bimap_iterator<OtherT, OtherBase, OtherHook, OtherIndex, T, Base, Hook,
+            Index>
             flip() const {
-            return bimap_iterator<OtherT, OtherBase, OtherTag, OtherCompare, T, Base,
-                Tag, Compare>(
-                    static_cast<intrusive::set_element<OtherTag>*>(
-                        static_cast<node_t*>(it)));
+            return bimap_iterator<OtherT, OtherBase, OtherHook, OtherIndex, T, Base,
+                Hook, Index>(static_cast<OtherHook*>(static_cast<node_t*>(it)));
         }
 
         bool operator==(bimap_iterator const& other) const {
@@ -110,93 +247,561 @@ public:
     private:
         friend struct bimap;
 
-        intrusive::set_element<Tag>* get_ptr() {
+        Hook* get_ptr() {
             return it;
         }
 
-        intrusive::set_element<Tag>* it;
+        Hook* it;
 
-        explicit bimap_iterator(intrusive::set_element<Tag>* ptr) : it(ptr) {}
+        // индекс отдает базовый тип своего элемента
+        template <typename Element>
+        explicit bimap_iterator(Element* ptr) : it(static_cast<Hook*>(ptr)) {}
     };
 
-    using left_iterator = bimap_iterator<left_t, Left, left_tag, CompareLeft,
-        right_t, Right, right_tag, CompareRight>;
-    using right_iterator = bimap_iterator<right_t, Right, right_tag, CompareRight,
-        left_t, Left, left_tag, CompareLeft>;
+    using left_iterator = bimap_iterator<left_t, Left, left_hook, left_set,
+        right_t, Right, right_hook, right_set>;
+    using right_iterator = bimap_iterator<right_t, Right, right_hook, right_set,
+        left_t, Left, left_hook, left_set>;
 
 public:
+    // Владеет узлом, вынутым extract_left/extract_right, пока он не
+    // вставлен в bimap того же типа с равным аллокатором. Ключи можно
+    // менять, пока узел ни с чем не связан.
+    struct node_type {
+        node_type() = default;
+
+        node_type(node_type&& other) noexcept
+            : ptr(std::exchange(other.ptr, nullptr)),
+            alloc(std::move(other.alloc)) {
+            other.alloc.reset();
+        }
+
+        node_type& operator=(node_type&& other) noexcept {
+            if (this != &other) {
+                reset();
+                ptr = std::exchange(other.ptr, nullptr);
+                alloc = std::move(other.alloc);
+                other.alloc.reset();
+            }
+            return *this;
+        }
+
+        node_type(node_type const&) = delete;
+        node_type& operator=(node_type const&) = delete;
+
+        ~node_type() {
+            reset();
+        }
+
+        bool empty() const noexcept {
+            return ptr == nullptr;
+        }
+
+        explicit operator bool() const noexcept {
+            return ptr != nullptr;
+        }
+
+        // Только у непустого
+        Left& left() const {
+            return static_cast<left_t*>(ptr)->elem;
+        }
+
+        Right& right() const {
+            return static_cast<right_t*>(ptr)->elem;
+        }
+
+        allocator_type get_allocator() const {
+            return allocator_type(*alloc);
+        }
+
+    private:
+        friend struct bimap;
+
+        node_type(node_t* ptr, node_allocator const& alloc)
+            : ptr(ptr), alloc(alloc) {}
+
+        void reset() noexcept {
+            if (ptr != nullptr) {
+                node_traits::destroy(*alloc, ptr);
+                node_traits::deallocate(*alloc, ptr, 1);
+                ptr = nullptr;
+            }
+            alloc.reset();
+        }
+
+        node_t* ptr{ nullptr };
+        std::optional<node_allocator> alloc;
+    };
+
     // Создает bimap не содержащий ни одной пары.
     bimap(CompareLeft left_cmp = CompareLeft(),
-        CompareRight right_cmp = CompareRight())
-        : l(static_cast<intrusive::set_element<left_tag>*>(&root), left_cmp),
-        r(static_cast<intrusive::set_element<right_tag>*>(&root), right_cmp) {}
+        CompareRight right_cmp = CompareRight(),
+        Allocator const& allocator = Allocator())
+        : l(make_index<left_set>(static_cast<left_hook*>(&root), left_cmp,
+            node_allocator(allocator))),
+        r(make_index<right_set>(static_cast<right_hook*>(&root), right_cmp,
+            node_allocator(allocator))),
+        alloc(allocator) {}
 
     // Конструкторы от других и присваивания
+    // O(n): копирует форму обоих деревьев вместе с приоритетами
     bimap(bimap const& other)
-        : l(static_cast<intrusive::set_element<left_tag>*>(&root), CompareLeft()),
-        r(static_cast<intrusive::set_element<right_tag>*>(&root),
-            CompareRight()) {
-        auto it = other.begin_left();
-        while (it != other.end_left()) {
-            auto right_it = it.flip();
-            insert(*it, *right_it);
-            it++;
-        }
-    }
+        : bimap(other,
+            node_traits::select_on_container_copy_construction(other.alloc),
+            clone_tag{}) {}
 
-    bimap(bimap&& other) noexcept = default;
+    bimap(bimap const& other, Allocator const& allocator)
+        : bimap(other, node_allocator(allocator), clone_tag{}) {}
+
+    bimap(bimap&& other) noexcept
+        : l(make_index<left_set>(static_cast<left_hook*>(&root),
+            static_cast<CompareLeft const&>(other.l), other.alloc)),
+        r(make_index<right_set>(static_cast<right_hook*>(&root),
+            static_cast<CompareRight const&>(other.r), other.alloc)),
+        alloc(other.alloc) {
+        swap_nodes(other);
+    }
 
     bimap& operator=(bimap const& other) {
-        if (*this != other) {
-            auto tmp = bimap<Left, Right, CompareLeft, CompareRight>(other);
-            (*this).swap(tmp);
+        if (this != &other) {
+            constexpr bool propagate =
+                node_traits::propagate_on_container_copy_assignment::value;
+            bimap tmp(other, propagate ? other.alloc : alloc, clone_tag{});
+            swap_nodes(tmp);
+            if constexpr (propagate) {
+                std::swap(alloc, tmp.alloc);
+            }
         }
         return *this;
     }
 
-    bimap& operator=(bimap&& other) noexcept {
-        if (*this != other) {
-            bimap<Left, Right, CompareLeft, CompareRight>(std::move(other))
-                .swap(*this);
+    bimap& operator=(bimap&& other) noexcept(
+        node_traits::propagate_on_container_move_assignment::value ||
+        node_traits::is_always_equal::value) {
+        if (this != &other) {
+            if constexpr (node_traits::propagate_on_container_move_assignment::
+                value) {
+                clear();
+                alloc = other.alloc;
+                swap_nodes(other);
+            }
+            else if (alloc == other.alloc) {
+                clear();
+                swap_nodes(other);
+            }
+            else {
+                // узлы нельзя передать в чужой аллокатор -- переносим ключи
+                bimap tmp(static_cast<CompareLeft const&>(other.l),
+                    static_cast<CompareRight const&>(other.r),
+                    allocator_type(alloc));
+                for (auto it = other.begin_left(); it != other.end_left(); it++) {
+                    auto ptr = static_cast<node_t*>(it.get_ptr());
+                    tmp.insert(std::move(static_cast<left_t*>(ptr)->elem),
+                        std::move(static_cast<right_t*>(ptr)->elem));
+                }
+                swap_nodes(tmp);
+                other.clear();
+            }
         }
         return *this;
     }
 
     void swap(bimap& other) {
-        l.swap(other.l);
-        r.swap(other.r);
-        std::swap(size_, other.size_);
+        if constexpr (node_traits::propagate_on_container_swap::value) {
+            std::swap(alloc, other.alloc);
+        }
+        else {
+            assert(alloc == other.alloc);
+        }
+        swap_nodes(other);
+    }
+
+    allocator_type get_allocator() const {
+        return allocator_type(alloc);
+    }
+
+    CompareLeft key_comp_left() const {
+        return static_cast<CompareLeft const&>(l);
+    }
+
+    CompareRight key_comp_right() const {
+        return static_cast<CompareRight const&>(r);
     }
 
     ~bimap() {
-        auto it = begin_left();
-        while (it != end_left()) {
-            auto tmp = std::next(it);
-            auto ptr = it.get_ptr();
-            node_t* parent_ptr = static_cast<node_t*>(ptr);
-            l.erase(static_cast<intrusive::set_element<left_tag>*>(parent_ptr));
-            delete parent_ptr;
-            it = tmp;
-            size_--;
+#ifndef BIMAP_STATS
+        static_assert(!stateless<left_side, CompareLeft> ||
+            sizeof(left_set) == sizeof(void*),
+            "bimap: an empty comparator must take no space");
+        static_assert(!stateless<right_side, CompareRight> ||
+            sizeof(right_set) == sizeof(void*),
+            "bimap: an empty comparator must take no space");
+        // корень без приоритета, два указателя на него и size_
+        static_assert(!stateless<left_side, CompareLeft> ||
+            !stateless<right_side, CompareRight> ||
+            !std::is_empty_v<node_allocator> ||
+            sizeof(bimap) == sizeof(root_pair) + 2 * sizeof(void*) + sizeof(size_t),
+            "bimap: unexpected padding");
+#endif
+        clear();
+    }
+
+    // Удаляет все пары за O(n), не перестраивая деревья.
+    void clear() noexcept {
+        r.detach_all();
+        if constexpr (releases_at_once<node_allocator>::value &&
+            std::is_trivially_destructible_v<Left> &&
+            std::is_trivially_destructible_v<Right>) {
+            // деструкторы узлов ничего не освобождают -- отдаем пул целиком
+            if (size_ != 0 && alloc.try_release()) {
+#ifdef BIMAP_STATS
+                deallocations += size_;
+#endif
+                l.detach_all();
+                size_ = 0;
+                return;
+            }
+        }
+        l.clear([this](left_t* value) {
+            destroy_node(static_cast<node_t*>(value));
+            });
+        size_ = 0;
+    }
+
+    // Создает bimap из пар (first, second), отсортированных по first строго
+    // по возрастанию. Работает за O(n) по левой стороне и O(n log n) по
+    // правой. Если first не возрастают или second повторяются -- бросает
+    // std::invalid_argument. Левая сторона должна быть упорядоченной.
+    template <typename InputIt>
+        requires left_side::ordered
+    static bimap from_sorted(InputIt first, InputIt last,
+        CompareLeft left_cmp = CompareLeft(),
+        CompareRight right_cmp = CompareRight(),
+        Allocator const& allocator = Allocator()) {
+        bimap res(std::move(left_cmp), std::move(right_cmp), allocator);
+        res.assign_sorted(first, last);
+        return res;
+    }
+
+    // Заменяет содержимое парами из [first, last), см. from_sorted.
+    // Строгая гарантия исключений.
+    template <typename InputIt>
+        requires left_side::ordered
+    void assign_sorted(InputIt first, InputIt last) {
+        assign_sorted(parallel::policy{ 1 }, first, last);
+    }
+
+    // То же на нескольких потоках: правая сторона сортируется по кускам,
+    // деревья строятся кусками независимо и сливаются merge. Узлы создаются
+    // параллельно, если итераторы произвольного доступа, а аллокатор без
+    // состояния (is_always_equal) -- такой должен быть потокобезопасным.
+    template <typename InputIt>
+        requires left_side::ordered
+    static bimap from_sorted(parallel::policy policy, InputIt first,
+        InputIt last, CompareLeft left_cmp = CompareLeft(),
+        CompareRight right_cmp = CompareRight(),
+        Allocator const& allocator = Allocator()) {
+        bimap res(std::move(left_cmp), std::move(right_cmp), allocator);
+        res.assign_sorted(policy, first, last);
+        return res;
+    }
+
+    template <typename InputIt>
+        requires left_side::ordered
+    void assign_sorted(parallel::policy policy, InputIt first, InputIt last) {
+        bimap tmp(static_cast<CompareLeft const&>(l),
+            static_cast<CompareRight const&>(r), allocator_type(alloc));
+        std::vector<node_t*> nodes;
+        if constexpr (std::random_access_iterator<InputIt> &&
+            node_traits::is_always_equal::value) {
+            auto n = static_cast<std::size_t>(last - first);
+            auto k = parallel::chunks_for(policy, n);
+            nodes.assign(n, nullptr);
+            try {
+                auto check = [&](std::size_t j) {
+                    if (!left_set::less(l, static_cast<left_t*>(nodes[j - 1])->elem,
+                        static_cast<left_t*>(nodes[j])->elem)) {
+                        throw std::invalid_argument("bimap: left keys are not sorted");
+                    }
+                };
+                parallel::run(k, [&](std::size_t i) {
+                    auto begin = parallel::chunk_begin(n, k, i);
+                    auto end = parallel::chunk_begin(n, k, i + 1);
+                    for (auto j = begin; j < end; j++) {
+                        nodes[j] = make_node(first[j].first, first[j].second);
+                        if (j > begin) {
+                            check(j);
+                        }
+                    }
+                    });
+                // стыки кусков
+                for (std::size_t i = 1; i < k; i++) {
+                    check(parallel::chunk_begin(n, k, i));
+                }
+            }
+            catch (...) {
+                for (auto* p : nodes) {
+                    if (p != nullptr) {
+                        free_node(p);
+                    }
+                }
+                throw;
+            }
+#ifdef BIMAP_STATS
+            tmp.allocations += n;
+#endif
+        }
+        else {
+            if constexpr (std::is_base_of_v<std::forward_iterator_tag,
+                typename std::iterator_traits<InputIt>::iterator_category>) {
+                nodes.reserve(static_cast<std::size_t>(std::distance(first, last)));
+            }
+            try {
+                for (; first != last; ++first) {
+                    nodes.push_back(nullptr);
+                    nodes.back() = create_node(first->first, first->second);
+                    if (nodes.size() > 1 &&
+                        !left_set::less(l,
+                            static_cast<left_t*>(nodes[nodes.size() - 2])->elem,
+                            static_cast<left_t*>(nodes.back())->elem)) {
+                        throw std::invalid_argument("bimap: left keys are not sorted");
+                    }
+                }
+            }
+            catch (...) {
+                for (auto* p : nodes) {
+                    if (p != nullptr) {
+                        destroy_node(p);
+                    }
+                }
+                throw;
+            }
+        }
+        // дальше узлами владеет tmp
+        tmp.link_sorted(nodes, parallel::chunks_for(policy, nodes.size()), true);
+        swap_nodes(tmp);
+    }
+
+    // Копия, построенная на нескольких потоках, с той же формой деревьев,
+    // что и у other: у узлов те же приоритеты. Если одна из сторон
+    // хеширована или аллокатор с состоянием -- обычное копирование.
+    bimap(parallel::policy policy, bimap const& other)
+        : bimap(static_cast<CompareLeft const&>(other.l),
+            static_cast<CompareRight const&>(other.r),
+            allocator_type(
+                node_traits::select_on_container_copy_construction(other.alloc))) {
+        if constexpr (left_side::ordered && right_side::ordered &&
+            node_traits::is_always_equal::value) {
+            auto n = other.size_;
+            std::vector<node_t*> sources;
+            sources.reserve(n);
+            other.l.for_each([&](node_t* p) { sources.push_back(p); });
+            std::vector<node_t*> nodes(n, nullptr);
+            auto k = parallel::chunks_for(policy, n);
+            try {
+                parallel::run(k, [&](std::size_t i) {
+                    auto end = parallel::chunk_begin(n, k, i + 1);
+                    for (auto j = parallel::chunk_begin(n, k, i); j < end; j++) {
+                        auto from = sources[j];
+                        nodes[j] = make_node(static_cast<left_t*>(from)->elem,
+                            static_cast<right_t*>(from)->elem);
+                        static_cast<intrusive::set_priority*>(nodes[j])->y =
+                            static_cast<intrusive::set_priority*>(from)->y;
+                    }
+                    });
+            }
+            catch (...) {
+                for (auto* p : nodes) {
+                    if (p != nullptr) {
+                        free_node(p);
+                    }
+                }
+                throw;
+            }
+#ifdef BIMAP_STATS
+            allocations += n;
+#endif
+            link_sorted(nodes, k, false);
+        }
+        else {
+            bimap tmp(other, alloc, clone_tag{});
+            swap_nodes(tmp);
+        }
+    }
+
+    // Ключи копируются или перемещаются прямо в узел и только если пара
+    // вставляется; при отказе возвращается end_left(), аргументы не тронуты
+    left_iterator insert(Left const& left, Right const& right) {
+        return insert_keys(left, right);
+    }
+
+    left_iterator insert(Left const& left, Right&& right) {
+        return insert_keys(left, std::move(right));
+    }
+
+    left_iterator insert(Left&& left, Right const& right) {
+        return insert_keys(std::move(left), right);
+    }
+
+    left_iterator insert(Left&& left, Right&& right) {
+        return insert_keys(std::move(left), std::move(right));
+    }
+
+    // Строит узел из args один раз, как std::pair<Left, Right>(args...),
+    // в том числе из std::piecewise_construct и двух кортежей. Если один
+    // из ключей занят, узел уничтожается и возвращается end_left().
+    template <typename... Args>
+    left_iterator emplace(Args&&... args) {
+        l.reserve(size_ + 1);
+        r.reserve(size_ + 1);
+        node_t* tmp = create_node(std::forward<Args>(args)...);
+        auto left_pos = l.find_position(static_cast<left_t*>(tmp)->elem);
+        auto right_pos = r.find_position(static_cast<right_t*>(tmp)->elem);
+        if (left_pos.existing != nullptr || right_pos.existing != nullptr) {
+            destroy_node(tmp);
+            return end_left();
+        }
+        return link_node(tmp, left_pos, right_pos);
+    }
+
+    // Если левый ключ занят, args не трогаются и возвращается end_left();
+    // иначе правый ключ строится из args прямо в узле
+    template <typename... Args>
+    left_iterator try_emplace_left(Left const& left, Args&&... args) {
+        return try_emplace_keys(left, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    left_iterator try_emplace_left(Left&& left, Args&&... args) {
+        return try_emplace_keys(std::move(left), std::forward<Args>(args)...);
+    }
+
+    // Переносит в результат все пары с левым ключом не меньше key. Узлы не
+    // копируются и не переаллоцируются: O(log n) по левой стороне и
+    // O(min(k, n - k) log n) по правой, где k -- число перенесенных пар.
+    bimap split_left(key_arg<Left> key)
+        requires left_side::ordered {
+        bimap res(static_cast<CompareLeft const&>(l),
+            static_cast<CompareRight const&>(r), allocator_type(alloc));
+        l.split_into(key, res.l);
+        // правую сторону перестраивает меньшая из половин
+        auto stay = begin_left(), moved = res.begin_left();
+        std::size_t k = 0;
+        while (stay != end_left() && moved != res.end_left()) {
+            ++stay;
+            ++moved;
+            k++;
+        }
+        bool move_out = moved == res.end_left();
+        try {
+            res.r.reserve(k);
+        }
+        catch (...) {
+            l.join(res.l);
+            throw;
+        }
+        if (!move_out) {
+            r.swap(res.r);
+        }
+        bimap& smaller = move_out ? res : *this;
+        auto& from = move_out ? r : res.r;
+        for (auto it = smaller.begin_left(); it != smaller.end_left(); ++it) {
+            auto ptr = static_cast<node_t*>(it.get_ptr());
+            from.erase(static_cast<right_hook*>(ptr));
+            smaller.r.insert(static_cast<right_t*>(ptr));
+        }
+        res.size_ = move_out ? k : size_ - k;
+        size_ -= res.size_;
+        return res;
+    }
+
+    // Забирает все пары other, other становится пустым. Левые ключи other
+    // должны целиком лежать до или после наших, правые -- не совпадать с
+    // нашими, иначе бросает std::invalid_argument и ничего не меняет.
+    // Узлы не переаллоцируются, аллокаторы должны быть равны. O(log n),
+    // если и правые ключи не пересекаются по диапазону, иначе
+    // O(min(n, m) log(n + m)).
+    void join(bimap& other)
+        requires left_side::ordered {
+        assert(alloc == other.alloc);
+        if (this == &other || other.empty()) {
+            return;
+        }
+        if (empty()) {
+            swap_nodes(other);
+            return;
+        }
+        bool after = left_set::less(l, *std::prev(end_left()), *other.begin_left());
+        if (!after && !left_set::less(l, *std::prev(other.end_left()), *begin_left())) {
+            throw std::invalid_argument("bimap: left key ranges overlap");
+        }
+        join_right(other);
+        if (after) {
+            l.join(other.l);
         }
+        else {
+            other.l.join(l);
+            l.swap(other.l);
+        }
+        size_ += other.size_;
+        other.size_ = 0;
+    }
+
+    void join(bimap&& other)
+        requires left_side::ordered {
+        join(other);
+    }
+
+    // Вынимает пару из обеих сторон вместе с узлом, без освобождения
+    // памяти и копирования ключей. O(log n) nothrow
+    node_type extract_left(left_iterator it) {
+        return extract_node(static_cast<node_t*>(it.get_ptr()));
+    }
+
+    node_type extract_right(right_iterator it) {
+        return extract_node(static_cast<node_t*>(it.get_ptr()));
+    }
+
+    // Если ключа нет -- пустой узел
+    node_type extract_left(key_arg<Left> left) {
+        auto it = find_left(left);
+        return it == end_left() ? node_type() : extract_left(it);
     }
 
-    left_iterator insert(Left left, Right right) {
-        if (find_left(left) == end_left() && find_right(right) == end_right()) {
-            node_t* tmp = new pair(std::move(left), std::move(right));
-            auto it = l.insert(static_cast<left_t*>(tmp));
-            r.insert(static_cast<right_t*>(tmp));
-            size_++;
-            return left_iterator(it);
+    node_type extract_right(key_arg<Right> right) {
+        auto it = find_right(right);
+        return it == end_right() ? node_type() : extract_right(it);
+    }
+
+    // Связывает узел, вынутый из этого или другого bimap, заново; аллокаторы
+    // должны быть равны. Если один из ключей занят или node пуст,
+    // возвращает end_left(), не трогая node; иначе node становится пустым.
+    left_iterator insert(node_type&& node) {
+        if (node.empty()) {
+            return end_left();
         }
-        return end_left();
+        assert(alloc == *node.alloc);
+        auto left_pos = l.find_position(node.left());
+        if (left_pos.existing != nullptr) {
+            return end_left();
+        }
+        auto right_pos = r.find_position(node.right());
+        if (right_pos.existing != nullptr) {
+            return end_left();
+        }
+        l.reserve(size_ + 1);
+        r.reserve(size_ + 1);
+        auto res = link_node(node.ptr, left_pos, right_pos);
+        node.ptr = nullptr;
+        node.alloc.reset();
+        return res;
     }
 
     left_iterator erase_left(left_iterator it) {
         return erase_left(it, std::next(it));
     }
 
-    bool erase_left(Left const& left) {
+    bool erase_left(key_arg<Left> left) {
         auto it = find_left(left);
         if (it != end_left()) {
             erase_left(it);
@@ -209,7 +814,7 @@ public:
         return erase_right(it, std::next(it));
     }
 
-    bool erase_right(Right const& right) {
+    bool erase_right(key_arg<Right> right) {
         auto it = find_right(right);
         if (it != end_right()) {
             erase_right(it);
@@ -219,6 +824,345 @@ public:
     }
 
 private:
+    // Упорядоченная сторона с пустым компаратором хранит только указатель
+    // на корень
+    template <typename Side, typename Policy>
+    static constexpr bool stateless = Side::ordered && std::is_empty_v<Policy>;
+
+    struct clone_tag {
+        explicit clone_tag() = default;
+    };
+
+    bimap(bimap const& other, node_allocator const& allocator, clone_tag)
+        : l(make_index<left_set>(static_cast<left_hook*>(&root),
+            static_cast<CompareLeft const&>(other.l), allocator)),
+        r(make_index<right_set>(static_cast<right_hook*>(&root),
+            static_cast<CompareRight const&>(other.r), allocator)),
+        alloc(allocator) {
+        clone_map copies(other.size_);
+        try {
+            l.clone_from(other.l, [&](left_t* source) -> left_t* {
+                auto from = static_cast<node_t*>(source);
+                node_t* tmp = create_node(static_cast<left_t*>(from)->elem,
+                    static_cast<right_t*>(from)->elem);
+                copies.insert(from, tmp);
+                return tmp;
+                });
+        }
+        catch (...) {
+            clear();
+            throw;
+        }
+        r.clone_from(other.r, [&](right_t* source) -> right_t* {
+            return copies.find(static_cast<node_t*>(source));
+            });
+        size_ = other.size_;
+    }
+
+    template <typename L, typename R>
+    left_iterator insert_keys(L&& left, R&& right) {
+        auto left_pos = l.find_position(left);
+        if (left_pos.existing != nullptr) {
+            return end_left();
+        }
+        auto right_pos = r.find_position(right);
+        if (right_pos.existing != nullptr) {
+            return end_left();
+        }
+        l.reserve(size_ + 1);
+        r.reserve(size_ + 1);
+        return link_node(
+            create_node(std::forward<L>(left), std::forward<R>(right)),
+            left_pos, right_pos);
+    }
+
+    template <typename L, typename... Args>
+    left_iterator try_emplace_keys(L&& left, Args&&... args) {
+        auto left_pos = l.find_position(left);
+        if (left_pos.existing != nullptr) {
+            return end_left();
+        }
+        l.reserve(size_ + 1);
+        r.reserve(size_ + 1);
+        node_t* tmp = create_node(std::piecewise_construct,
+            std::forward_as_tuple(std::forward<L>(left)),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+        auto right_pos = r.find_position(static_cast<right_t*>(tmp)->elem);
+        if (right_pos.existing != nullptr) {
+            destroy_node(tmp);
+            return end_left();
+        }
+        return link_node(tmp, left_pos, right_pos);
+    }
+
+    // O(log n) nothrow, позиции найдены для ключей tmp, место на обеих
+    // сторонах зарезервировано
+    template <typename LeftPos, typename RightPos>
+    left_iterator link_node(node_t* tmp, LeftPos const& left_pos,
+        RightPos const& right_pos) {
+        auto it = l.insert_at(left_pos, static_cast<left_t*>(tmp));
+        r.insert_at(right_pos, static_cast<right_t*>(tmp));
+        size_++;
+        return left_iterator(it);
+    }
+
+    // Пара с ключом по умолчанию на другой стороне вытесняется, узел
+    // строится один раз
+    template <typename K>
+    Right const& left_or_default(K&& key) {
+        auto left_pos = l.find_position(key);
+        if (left_pos.existing != nullptr) {
+            return *left_iterator(left_pos.existing).flip();
+        }
+        l.reserve(size_ + 1);
+        r.reserve(size_ + 1);
+        node_t* tmp = create_node(std::piecewise_construct,
+            std::forward_as_tuple(std::forward<K>(key)), std::tuple<>());
+        auto right_pos = r.find_position(static_cast<right_t*>(tmp)->elem);
+        if (right_pos.existing != nullptr) {
+            erase_right(right_iterator(right_pos.existing));
+            left_pos = l.find_position(static_cast<left_t*>(tmp)->elem);
+            right_pos = r.find_position(static_cast<right_t*>(tmp)->elem);
+        }
+        return *link_node(tmp, left_pos, right_pos).flip();
+    }
+
+    template <typename K>
+    Left const& right_or_default(K&& key) {
+        auto right_pos = r.find_position(key);
+        if (right_pos.existing != nullptr) {
+            return *right_iterator(right_pos.existing).flip();
+        }
+        l.reserve(size_ + 1);
+        r.reserve(size_ + 1);
+        node_t* tmp = create_node(std::piecewise_construct, std::tuple<>(),
+            std::forward_as_tuple(std::forward<K>(key)));
+        auto left_pos = l.find_position(static_cast<left_t*>(tmp)->elem);
+        if (left_pos.existing != nullptr) {
+            erase_left(left_iterator(left_pos.existing));
+            left_pos = l.find_position(static_cast<left_t*>(tmp)->elem);
+            right_pos = r.find_position(static_cast<right_t*>(tmp)->elem);
+        }
+        return *link_node(tmp, left_pos, right_pos);
+    }
+
+    template <typename... Args>
+    node_t* create_node(Args&&... args) {
+        node_t* ptr = make_node(std::forward<Args>(args)...);
+#ifdef BIMAP_STATS
+        allocations++;
+#endif
+        return ptr;
+    }
+
+    void destroy_node(node_t* ptr) noexcept {
+        free_node(ptr);
+#ifdef BIMAP_STATS
+        deallocations++;
+#endif
+    }
+
+    // Без статистики, поэтому их можно звать из нескольких потоков, если
+    // аллокатор это позволяет
+    template <typename... Args>
+    node_t* make_node(Args&&... args) {
+        node_t* ptr = node_traits::allocate(alloc, 1);
+        try {
+            node_traits::construct(alloc, ptr, std::forward<Args>(args)...);
+        }
+        catch (...) {
+            node_traits::deallocate(alloc, ptr, 1);
+            throw;
+        }
+        return ptr;
+    }
+
+    void free_node(node_t* ptr) noexcept {
+        node_traits::destroy(alloc, ptr);
+        node_traits::deallocate(alloc, ptr, 1);
+    }
+
+    // Связывает пустой bimap из узлов, упорядоченных по левому ключу, и
+    // забирает их себе. k -- число кусков, на которые делится работа.
+    void link_sorted(std::vector<node_t*>& nodes, std::size_t k,
+        bool check_right) {
+        build_side<true>(nodes, k);
+        size_ = nodes.size();
+        if constexpr (right_side::ordered) {
+            parallel::sort(nodes.begin(), nodes.end(), [&](node_t* a, node_t* b) {
+                return right_set::less(r, static_cast<right_t*>(a)->elem,
+                    static_cast<right_t*>(b)->elem);
+                }, k);
+            if (check_right) {
+                auto n = nodes.size();
+                parallel::run(k, [&](std::size_t i) {
+                    auto end = parallel::chunk_begin(n, k, i + 1);
+                    for (auto j = std::max<std::size_t>(
+                        parallel::chunk_begin(n, k, i), 1); j < end; j++) {
+                        if (!right_set::less(r, static_cast<right_t*>(nodes[j - 1])->elem,
+                            static_cast<right_t*>(nodes[j])->elem)) {
+                            throw std::invalid_argument("bimap: duplicate right key");
+                        }
+                    }
+                    });
+            }
+            build_side<false>(nodes, k);
+        }
+        else {
+            r.reserve(nodes.size());
+            for (auto* p : nodes) {
+                auto pos = r.find_position(static_cast<right_t*>(p)->elem);
+                if (pos.existing != nullptr) {
+                    throw std::invalid_argument("bimap: duplicate right key");
+                }
+                r.insert_at(pos, static_cast<right_t*>(p));
+            }
+        }
+    }
+
+    // Дерево стороны строится из k кусков nodes независимо, каждый под
+    // своим временным корнем, и куски сливаются по порядку.
+    template <bool IsLeft>
+    void build_side(std::vector<node_t*> const& nodes, std::size_t k) {
+        using hook = std::conditional_t<IsLeft, left_hook, right_hook>;
+        using index = std::conditional_t<IsLeft, left_set, right_set>;
+        using compare = std::conditional_t<IsLeft, CompareLeft, CompareRight>;
+        auto& to = side_set<IsLeft>();
+        if (k == 1) {
+            to.build_sorted(nodes.begin(), nodes.end());
+            return;
+        }
+        auto n = nodes.size();
+        std::vector<root_pair> roots(k);
+        auto part = [&](std::size_t i) {
+            return make_index<index>(static_cast<hook*>(&roots[i]),
+                static_cast<compare const&>(to), alloc);
+        };
+        parallel::run(k, [&](std::size_t i) {
+            part(i).build_sorted(nodes.begin() + parallel::chunk_begin(n, k, i),
+                nodes.begin() + parallel::chunk_begin(n, k, i + 1));
+            });
+        for (std::size_t i = 0; i < k; i++) {
+            auto from = part(i);
+            to.join(from);
+        }
+    }
+
+    // Переносит правую сторону other к нашей. Строгая гарантия.
+    void join_right(bimap& other) {
+        if constexpr (right_side::ordered) {
+            if (right_set::less(r, *std::prev(end_right()), *other.begin_right())) {
+                r.join(other.r);
+                return;
+            }
+            if (right_set::less(r, *std::prev(other.end_right()), *begin_right())) {
+                other.r.join(r);
+                r.swap(other.r);
+                return;
+            }
+        }
+        bool into_ours = size_ >= other.size_;
+        auto& to = into_ours ? r : other.r;
+        bimap& smaller = into_ours ? other : *this;
+        for (auto it = smaller.begin_right(); it != smaller.end_right(); ++it) {
+            if (to.find_position(*it).existing != nullptr) {
+                throw std::invalid_argument("bimap: duplicate right key");
+            }
+        }
+        to.reserve(size_ + other.size_);
+        smaller.r.clear([&](right_t* value) {
+            to.insert(value);
+            });
+        if (!into_ours) {
+            r.swap(other.r);
+        }
+    }
+
+    template <typename Index, typename Hook, typename Policy>
+    static Index make_index(Hook* root, Policy const& policy,
+        node_allocator const& allocator) {
+        if constexpr (std::is_constructible_v<Index, Hook*, Policy const&,
+            node_allocator const&>) {
+            return Index(root, policy, allocator);
+        }
+        else {
+            return Index(root, policy);
+        }
+    }
+
+    void swap_nodes(bimap& other) {
+        l.swap(other.l);
+        r.swap(other.r);
+        std::swap(size_, other.size_);
+    }
+
+    // Отображение узлов оригинала в их копии при копировании: открытая
+    // адресация в одном массиве, без аллокации на элемент.
+    struct clone_map {
+        explicit clone_map(std::size_t n) {
+            std::size_t capacity = 1;
+            while (capacity < 2 * n) {
+                capacity *= 2;
+                shift--;
+            }
+            table.resize(capacity, { nullptr, nullptr });
+        }
+
+        void insert(node_t const* from, node_t* to) {
+            auto i = slot(from);
+            while (table[i].first != nullptr) {
+                i = (i + 1) & (table.size() - 1);
+            }
+            table[i] = { from, to };
+        }
+
+        node_t* find(node_t const* from) const {
+            auto i = slot(from);
+            while (table[i].first != from) {
+                i = (i + 1) & (table.size() - 1);
+            }
+            return table[i].second;
+        }
+
+    private:
+        std::size_t slot(node_t const* from) const {
+            auto h = static_cast<std::uint64_t>(
+                reinterpret_cast<std::uintptr_t>(from)) * 0x9e3779b97f4a7c15ull;
+            return shift >= 64 ? 0 : static_cast<std::size_t>(h >> shift);
+        }
+
+        std::vector<std::pair<node_t const*, node_t*>> table;
+        unsigned shift{ 64 };
+    };
+
+    template <typename C, typename = void>
+    struct is_transparent : std::false_type {};
+
+    template <typename C>
+    struct is_transparent<C, std::void_t<typename C::is_transparent>>
+        : std::true_type {};
+
+    // хеш-сторона прозрачна, если прозрачны и хеш, и равенство
+    template <typename Hash, typename KeyEqual>
+    struct is_transparent<intrusive::hashed<Hash, KeyEqual>, void>
+        : std::conjunction<is_transparent<Hash>, is_transparent<KeyEqual>> {};
+
+    template <typename Iterator>
+    static auto const& at(Iterator it, Iterator end) {
+        if (it == end) {
+            throw std::out_of_range("");
+        }
+        return *it.flip();
+    }
+
+    template <typename A, typename = void>
+    struct releases_at_once : std::false_type {};
+
+    template <typename A>
+    struct releases_at_once<A,
+        std::void_t<decltype(std::declval<A&>().try_release())>>
+        : std::true_type {};
+
     template <class IteratorType>
     IteratorType erase_range(IteratorType first, IteratorType last) {
         auto it = first;
@@ -226,88 +1170,338 @@ private:
             auto tmp = std::next(it);
             auto ptr = it.get_ptr();
             node_t* parent_ptr = static_cast<node_t*>(ptr);
-            l.erase(static_cast<intrusive::set_element<left_tag>*>(parent_ptr));
-            r.erase(static_cast<intrusive::set_element<right_tag>*>(parent_ptr));
-            delete parent_ptr;
+            l.erase(static_cast<left_hook*>(parent_ptr));
+            r.erase(static_cast<right_hook*>(parent_ptr));
+            destroy_node(parent_ptr);
             it = tmp;
             size_--;
         }
         return last;
     }
 
+    node_type extract_node(node_t* ptr) noexcept {
+        l.erase(static_cast<left_hook*>(ptr));
+        r.erase(static_cast<right_hook*>(ptr));
+        size_--;
+        return node_type(ptr, alloc);
+    }
+
+    template <bool IsLeft>
+    auto& side_set() {
+        if constexpr (IsLeft) {
+            return l;
+        }
+        else {
+            return r;
+        }
+    }
+
+    // Диапазон вырезается из упорядоченной стороны From двумя split и
+    // одним merge. С другой стороны его узлы снимаются по одному, а если
+    // диапазон большой -- сторона заново строится из оставшихся за O(n).
+    template <bool FromLeft, class IteratorType>
+    IteratorType erase_cut(IteratorType first, IteratorType last) {
+        using from_side = std::conditional_t<FromLeft, left_side, right_side>;
+        using other_side = std::conditional_t<FromLeft, right_side, left_side>;
+        using from_set = std::conditional_t<FromLeft, left_set, right_set>;
+        using from_t = std::conditional_t<FromLeft, left_t, right_t>;
+        using other_t = std::conditional_t<FromLeft, right_t, left_t>;
+        using other_hook = typename other_side::hook;
+        using from_compare = std::conditional_t<FromLeft, CompareLeft, CompareRight>;
+
+        auto& from = side_set<FromLeft>();
+        auto& other = side_set<!FromLeft>();
+        root_pair cut_root;
+        auto cut = make_index<from_set>(
+            static_cast<typename from_side::hook*>(&cut_root),
+            static_cast<from_compare const&>(from), alloc);
+        auto first_node = static_cast<node_t*>(first.get_ptr());
+        auto last_node = static_cast<node_t*>(last.get_ptr());
+        from.cut(first.get_ptr(), last.get_ptr(), cut);
+        std::size_t k = 0;
+        for (auto it = IteratorType(cut.begin()); it != IteratorType(cut.end()); ++it) {
+            k++;
+        }
+
+        // k узлов по O(log n) против одного обхода всех n
+        bool rebuilt = false;
+        if constexpr (other_side::ordered) {
+            if (k > size_ / rebuild_ratio) {
+                std::vector<other_t*> keep;
+                try {
+                    keep.reserve(size_ - k);
+                }
+                catch (...) {
+                }
+                if (keep.capacity() >= size_ - k) {
+                    auto const& key_first = static_cast<from_t*>(first_node)->elem;
+                    for (auto tr = other.begin(); tr != other.end();
+                        tr = static_cast<decltype(tr)>(other.get_next(tr))) {
+                        auto node = static_cast<node_t*>(static_cast<other_hook*>(tr));
+                        auto const& key = static_cast<from_t*>(node)->elem;
+                        if (from_set::less(from, key, key_first) ||
+                            (last_node != &root &&
+                                !from_set::less(from, key,
+                                    static_cast<from_t*>(last_node)->elem))) {
+                            keep.push_back(static_cast<other_t*>(node));
+                        }
+                    }
+                    other.detach_all();
+                    other.build_sorted(keep.begin(), keep.end());
+                    rebuilt = true;
+                }
+            }
+        }
+        cut.clear([&](from_t* value) {
+            auto node = static_cast<node_t*>(value);
+            if (!rebuilt) {
+                other.erase(static_cast<other_hook*>(node));
+            }
+            destroy_node(node);
+            });
+        size_ -= k;
+        return last;
+    }
+
+    // во сколько раз диапазон меньше bimap, чтобы другую сторону было
+    // выгоднее править по узлу, чем перестроить
+    static constexpr std::size_t rebuild_ratio = 8;
+
 public:
     left_iterator erase_left(left_iterator first, left_iterator last) {
+        if constexpr (left_side::ordered) {
+            if (first != last && std::next(first) != last) {
+                return erase_cut<true>(first, last);
+            }
+        }
         return erase_range<left_iterator>(first, last);
     }
 
     right_iterator erase_right(right_iterator first, right_iterator last) {
+        if constexpr (right_side::ordered) {
+            if (first != last && std::next(first) != last) {
+                return erase_cut<false>(first, last);
+            }
+        }
         return erase_range<right_iterator>(first, last);
     }
 
     // Возвращает итератор по элементу. Если не найден - соответствующий end()
-    left_iterator find_left(Left const& left) const {
+    left_iterator find_left(key_arg<Left> left) const {
         return left_iterator(l.find(left));
     }
 
-    right_iterator find_right(Right const& right) const {
+    right_iterator find_right(key_arg<Right> right) const {
         return right_iterator(r.find(right));
     }
 
-    // Возвращает противоположный элемент по элементу
-    // Если элемента не существует -- бросает std::out_of_range
-    Right const& at_left(Left const& key) const {
-        auto it = find_left(key);
-        if (it == end_left()) {
-            throw std::out_of_range("");
+    // Если компаратор прозрачный (is_transparent), искать можно по любому
+    // ключу, который он умеет сравнивать, без создания временного Left/Right
+    template <typename K, typename C = CompareLeft,
+        std::enable_if_t<is_transparent<C>::value, int> = 0>
+    left_iterator find_left(K const& left) const {
+        return left_iterator(l.find(left));
+    }
+
+    template <typename K, typename C = CompareRight,
+        std::enable_if_t<is_transparent<C>::value, int> = 0>
+    right_iterator find_right(K const& right) const {
+        return right_iterator(r.find(right));
+    }
+
+    // Ищет сразу все keys: out[i] -- итератор на keys[i] или end_left().
+    // Спуски для соседних ключей идут поочередно, и промахи кэша у них
+    // перекрываются. out.size() >= keys.size()
+    void find_left_batch(std::span<Left const> keys,
+        std::span<left_iterator> out) const {
+        assert(out.size() >= keys.size());
+        l.find_batch(keys.data(), keys.size(),
+            [&](std::size_t i, auto* res) {
+                out[i] = left_iterator(res);
+            });
+    }
+
+    void find_right_batch(std::span<Right const> keys,
+        std::span<right_iterator> out) const {
+        assert(out.size() >= keys.size());
+        r.find_batch(keys.data(), keys.size(),
+            [&](std::size_t i, auto* res) {
+                out[i] = right_iterator(res);
+            });
+    }
+
+    // Обходит пары в порядке левой стороны и вызывает fn(left, right), для
+    // правой -- fn(right, left). Быстрее, чем ++ по итераторам: дерево
+    // обходится с явным стеком, без подъемов по родителям. Менять bimap из
+    // fn нельзя.
+    template <typename F>
+    void for_each_left(F fn) const {
+        l.for_each([&](node_t* p) {
+            fn(static_cast<left_t*>(p)->elem, static_cast<right_t*>(p)->elem);
+            });
+    }
+
+    template <typename F>
+    void for_each_right(F fn) const {
+        r.for_each([&](node_t* p) {
+            fn(static_cast<right_t*>(p)->elem, static_cast<left_t*>(p)->elem);
+            });
+    }
+
+    // То же для пар с ключом из [lo, hi), только для упорядоченных сторон
+    template <typename F>
+    void for_each_left(key_arg<Left> lo, key_arg<Left> hi, F fn) const
+        requires left_side::ordered {
+        if (!left_set::less(l, lo, hi)) {
+            return;
         }
-        return *(it.flip());
+        l.for_each(lo, l.lower_bound(hi), [&](node_t* p) {
+            fn(static_cast<left_t*>(p)->elem, static_cast<right_t*>(p)->elem);
+            });
     }
 
-    Left const& at_right(Right const& key) const {
-        auto it = find_right(key);
-        if (it == end_right()) {
-            throw std::out_of_range("");
+    template <typename F>
+    void for_each_right(key_arg<Right> lo, key_arg<Right> hi, F fn) const
+        requires right_side::ordered {
+        if (!right_set::less(r, lo, hi)) {
+            return;
         }
-        return *(it.flip());
+        r.for_each(lo, r.lower_bound(hi), [&](node_t* p) {
+            fn(static_cast<right_t*>(p)->elem, static_cast<left_t*>(p)->elem);
+            });
+    }
+
+    // Возвращает противоположный элемент по элементу
+    // Если элемента не существует -- бросает std::out_of_range
+    Right const& at_left(key_arg<Left> key) const {
+        return at(find_left(key), end_left());
+    }
+
+    Left const& at_right(key_arg<Right> key) const {
+        return at(find_right(key), end_right());
+    }
+
+    template <typename K, typename C = CompareLeft,
+        std::enable_if_t<is_transparent<C>::value, int> = 0>
+    Right const& at_left(K const& key) const {
+        return at(find_left(key), end_left());
+    }
+
+    template <typename K, typename C = CompareRight,
+        std::enable_if_t<is_transparent<C>::value, int> = 0>
+    Left const& at_right(K const& key) const {
+        return at(find_right(key), end_right());
     }
 
     template <typename T = Right,
         std::enable_if_t<std::is_default_constructible_v<T>, int> = 0>
     Right const& at_left_or_default(Left const& key) {
-        auto it = find_left(key);
-        if (it != end_left()) {
-            return *it.flip();
-        }
-        erase_right(Right());
-        return *(insert(key, Right()).flip());
+        return left_or_default(key);
+    }
+
+    template <typename T = Right,
+        std::enable_if_t<std::is_default_constructible_v<T>, int> = 0>
+    Right const& at_left_or_default(Left&& key) {
+        return left_or_default(std::move(key));
     }
 
     template <typename T = Left,
         std::enable_if_t<std::is_default_constructible_v<T>, int> = 0>
     Left const& at_right_or_default(Right const& key) {
-        auto it = find_right(key);
-        if (it != end_right()) {
-            return *it.flip();
-        }
-        erase_left(Left());
-        return *(insert(Left(), key));
+        return right_or_default(key);
+    }
+
+    template <typename T = Left,
+        std::enable_if_t<std::is_default_constructible_v<T>, int> = 0>
+    Left const& at_right_or_default(Right&& key) {
+        return right_or_default(std::move(key));
     }
 
-    left_iterator lower_bound_left(const Left& left) const {
+    // Только для упорядоченных сторон
+    left_iterator lower_bound_left(key_arg<Left> left) const
+        requires left_side::ordered {
         return left_iterator(l.lower_bound(left));
     }
-    left_iterator upper_bound_left(const Left& left) const {
+    left_iterator upper_bound_left(key_arg<Left> left) const
+        requires left_side::ordered {
         return left_iterator(l.upper_bound(left));
     }
 
-    right_iterator lower_bound_right(const Right& left) const {
+    right_iterator lower_bound_right(key_arg<Right> left) const
+        requires right_side::ordered {
         return right_iterator(r.lower_bound(left));
     }
 
-    right_iterator upper_bound_right(const Right& left) const {
+    right_iterator upper_bound_right(key_arg<Right> left) const
+        requires right_side::ordered {
         return right_iterator(r.upper_bound(left));
     }
 
+    template <typename K, typename C = CompareLeft,
+        std::enable_if_t<is_transparent<C>::value, int> = 0>
+        requires left_side::ordered
+    left_iterator lower_bound_left(K const& left) const {
+        return left_iterator(l.lower_bound(left));
+    }
+
+    template <typename K, typename C = CompareLeft,
+        std::enable_if_t<is_transparent<C>::value, int> = 0>
+        requires left_side::ordered
+    left_iterator upper_bound_left(K const& left) const {
+        return left_iterator(l.upper_bound(left));
+    }
+
+    template <typename K, typename C = CompareRight,
+        std::enable_if_t<is_transparent<C>::value, int> = 0>
+        requires right_side::ordered
+    right_iterator lower_bound_right(K const& right) const {
+        return right_iterator(r.lower_bound(right));
+    }
+
+    template <typename K, typename C = CompareRight,
+        std::enable_if_t<is_transparent<C>::value, int> = 0>
+        requires right_side::ordered
+    right_iterator upper_bound_right(K const& right) const {
+        return right_iterator(r.upper_bound(right));
+    }
+
+    // Порядковые статистики, O(log n); только для сторон
+    // intrusive::ranked<Compare>.
+    // k-й по порядку элемент (с нуля) или end(), если элементов не больше k
+    left_iterator nth_left(std::size_t k) const
+        requires left_side::ranked {
+        return left_iterator(l.nth(k));
+    }
+
+    right_iterator nth_right(std::size_t k) const
+        requires right_side::ranked {
+        return right_iterator(r.nth(k));
+    }
+
+    // Сколько элементов меньше key
+    std::size_t rank_left(key_arg<Left> key) const
+        requires left_side::ranked {
+        return l.count_before(key);
+    }
+
+    std::size_t rank_right(key_arg<Right> key) const
+        requires right_side::ranked {
+        return r.count_before(key);
+    }
+
+    // Сколько элементов в [lo, hi)
+    std::size_t count_left(key_arg<Left> lo, key_arg<Left> hi) const
+        requires left_side::ranked {
+        auto before = l.count_before(lo);
+        return std::max(l.count_before(hi), before) - before;
+    }
+
+    std::size_t count_right(key_arg<Right> lo, key_arg<Right> hi) const
+        requires right_side::ranked {
+        auto before = r.count_before(lo);
+        return std::max(r.count_before(hi), before) - before;
+    }
+
     left_iterator begin_left() const {
         return left_iterator(l.begin());
     }
@@ -332,13 +1526,46 @@ public:
         return size_;
     }
 
+#ifdef BIMAP_STATS
+    // Статистика, только с BIMAP_STATS. Счетчики узлов -- за время жизни
+    // объекта (узлы, перенесенные split_left/join, не считаются), счетчики
+    // сторон -- вызовы split/merge и компаратора (для хешированной стороны
+    // -- KeyEqual). Глубины считаются при вызове за O(n). Подсчет идет и в
+    // const-поиске, поэтому такой bimap нельзя читать из нескольких потоков.
+    struct stats_type {
+        std::size_t allocations;
+        std::size_t deallocations;
+        intrusive::index_stats left;
+        intrusive::index_stats right;
+    };
+
+    stats_type stats() const {
+        return { allocations, deallocations, l.stats(), r.stats() };
+    }
+#endif
+
 public:
+    // Сравнивает пары в порядке упорядоченной стороны
     friend bool operator==(bimap const& a, bimap const& b) {
         if (a.size() != b.size()) {
             return false;
         }
-        auto a_it = a.begin_left(), b_it = b.begin_left();
-        while (a_it != a.end_left()) {
+        if constexpr (left_side::ordered) {
+            return equal_pairs(a.begin_left(), a.end_left(), b.begin_left());
+        }
+        else {
+            return equal_pairs(a.begin_right(), a.end_right(), b.begin_right());
+        }
+    }
+
+    friend bool operator!=(bimap const& a, bimap const& b) {
+        return !(a == b);
+    }
+
+private:
+    template <typename Iterator>
+    static bool equal_pairs(Iterator a_it, Iterator a_end, Iterator b_it) {
+        while (a_it != a_end) {
             auto a_right_it = a_it.flip(), b_right_it = b_it.flip();
             if (!(*a_it == *b_it) || !(*a_right_it == *b_right_it)) {
                 return false;
@@ -348,8 +1575,4 @@ public:
         }
         return true;
     }
-
-    friend bool operator!=(bimap const& a, bimap const& b) {
-        return !(a == b);
-    }
 };
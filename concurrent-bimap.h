@@ -0,0 +1,701 @@
+#pragma once
+
+#include "intrusive-set.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional> // std::less
+#include <mutex>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <utility> // std::pair, std::move
+#include <vector>
+
+namespace persistent {
+
+// Epoch based reclamation for one writer and any number of readers.
+//
+// Readers announce themselves in one of two counters (by parity of the
+// current epoch) in a per-thread slot, so they never write to a shared
+// cache line. The writer may advance the epoch from e to e + 1 only once
+// every reader of epoch e - 1 has left; at that point nothing retired
+// during e - 1 is reachable any more.
+struct epoch_domain {
+    static constexpr std::size_t slot_count = 64;
+
+    epoch_domain() = default;
+    epoch_domain(epoch_domain const&) = delete;
+    epoch_domain& operator=(epoch_domain const&) = delete;
+
+private:
+    struct alignas(64) slot {
+        std::atomic<std::size_t> readers[2]{};
+    };
+
+public:
+    struct guard {
+        explicit guard(epoch_domain const& domain) : s(&domain.own_slot()) {
+            for (;;) {
+                auto e = domain.epoch.load();
+                parity = static_cast<unsigned>(e & 1);
+                s->readers[parity].fetch_add(1);
+                if (domain.epoch.load() == e) {
+                    return;
+                }
+                s->readers[parity].fetch_sub(1);
+            }
+        }
+
+        guard(guard&& other) noexcept : s(other.s), parity(other.parity) {
+            other.s = nullptr;
+        }
+
+        guard(guard const&) = delete;
+        guard& operator=(guard const&) = delete;
+        guard& operator=(guard&&) = delete;
+
+        ~guard() {
+            if (s != nullptr) {
+                s->readers[parity].fetch_sub(1);
+            }
+        }
+
+    private:
+        slot* s;
+        unsigned parity{ 0 };
+    };
+
+    // Writer only. Returns the parity whose retired objects became
+    // unreachable, the caller frees them before the next advance.
+    std::optional<unsigned> try_advance() {
+        auto e = epoch.load(std::memory_order_relaxed);
+        unsigned drained = static_cast<unsigned>((e + 1) & 1);
+        for (auto const& s : slots) {
+            if (s.readers[drained].load() != 0) {
+                return std::nullopt;
+            }
+        }
+        epoch.store(e + 1);
+        return drained;
+    }
+
+    // Writer only. Parity of the epoch objects are being retired in.
+    unsigned current_parity() const {
+        return static_cast<unsigned>(epoch.load(std::memory_order_relaxed) & 1);
+    }
+
+private:
+    static std::size_t slot_index() {
+        static std::atomic<std::size_t> next{ 0 };
+        thread_local std::size_t index =
+            next.fetch_add(1, std::memory_order_relaxed) % slot_count;
+        return index;
+    }
+
+    slot& own_slot() const {
+        return slots[slot_index()];
+    }
+
+    std::atomic<std::uint64_t> epoch{ 0 };
+    mutable slot slots[slot_count];
+};
+
+// Immutable treap node. Once published, a node is never written to again:
+// updates copy the path from the root to the changed position.
+template <typename Value>
+struct node {
+    Value const* value;
+    node const* left;
+    node const* right;
+    std::uint32_t y;
+};
+
+// Nodes created and replaced by one update. On failure the created
+// ones are unpublished and freed, on success the replaced ones are
+// retired.
+template <typename Value>
+struct transaction {
+    using node_t = node<Value>;
+
+    std::vector<node_t*> created;
+    std::vector<node_t const*> retired;
+
+    node_t* make(node_t const& proto) {
+        created.push_back(nullptr);
+        created.back() = new node_t(proto);
+        return created.back();
+    }
+
+    node_t* copy(node_t const* tr) {
+        retired.push_back(tr);
+        return make(*tr);
+    }
+
+    void rollback() noexcept {
+        for (auto* p : created) {
+            delete p;
+        }
+        created.clear();
+        retired.clear();
+    }
+};
+
+template <typename Value, typename Key, Key const& (*get_key)(Value const&),
+    typename Compare>
+struct treap {
+    using node_t = node<Value>;
+    using transaction = persistent::transaction<Value>;
+
+    static Key const& key(node_t const* tr) {
+        return get_key(*tr->value);
+    }
+
+    // O(h) nothrow, read-only
+    static node_t const* lower_bound(node_t const* tr, Key const& value,
+        Compare const& comparator) {
+        node_t const* res = nullptr;
+        while (tr != nullptr) {
+            if (comparator(key(tr), value)) {
+                tr = tr->right;
+            }
+            else {
+                res = tr;
+                tr = tr->left;
+            }
+        }
+        return res;
+    }
+
+    // O(h) nothrow, read-only
+    static node_t const* upper_bound(node_t const* tr, Key const& value,
+        Compare const& comparator) {
+        node_t const* res = nullptr;
+        while (tr != nullptr) {
+            if (comparator(value, key(tr))) {
+                res = tr;
+                tr = tr->left;
+            }
+            else {
+                tr = tr->right;
+            }
+        }
+        return res;
+    }
+
+    // O(h) nothrow, read-only
+    static node_t const* find(node_t const* tr, Key const& value,
+        Compare const& comparator) {
+        auto res = lower_bound(tr, value, comparator);
+        if (res != nullptr && !comparator(value, key(res))) {
+            return res;
+        }
+        return nullptr;
+    }
+
+    static std::pair<node_t const*, node_t const*>
+        split(node_t const* tr, Key const& value, Compare const& comparator,
+            transaction& txn) {
+        if (tr == nullptr) {
+            return { nullptr, nullptr };
+        }
+        auto copy = txn.copy(tr);
+        if (comparator(key(tr), value)) {
+            auto p = split(tr->right, value, comparator, txn);
+            copy->right = p.first;
+            return { copy, p.second };
+        }
+        else {
+            auto p = split(tr->left, value, comparator, txn);
+            copy->left = p.second;
+            return { p.first, copy };
+        }
+    }
+
+    static node_t const* merge(node_t const* left, node_t const* right,
+        transaction& txn) {
+        if (!left || !right) {
+            if (left) {
+                return left;
+            }
+            return right;
+        }
+        if (left->y < right->y) {
+            auto copy = txn.copy(left);
+            copy->right = merge(left->right, right, txn);
+            return copy;
+        }
+        else {
+            auto copy = txn.copy(right);
+            copy->left = merge(left, right->left, txn);
+            return copy;
+        }
+    }
+
+    // O(h) strong, value must not be present
+    static node_t const* insert(node_t const* tr, node_t* value,
+        Compare const& comparator, transaction& txn) {
+        if (tr == nullptr) {
+            return value;
+        }
+        if (value->y < tr->y) {
+            auto p = split(tr, key(value), comparator, txn);
+            value->left = p.first;
+            value->right = p.second;
+            return value;
+        }
+        auto copy = txn.copy(tr);
+        if (comparator(key(value), key(tr))) {
+            copy->left = insert(tr->left, value, comparator, txn);
+        }
+        else {
+            copy->right = insert(tr->right, value, comparator, txn);
+        }
+        return copy;
+    }
+
+    // O(h) strong, value must be present
+    static node_t const* erase(node_t const* tr, Key const& value,
+        Compare const& comparator, transaction& txn) {
+        if (comparator(value, key(tr))) {
+            auto copy = txn.copy(tr);
+            copy->left = erase(tr->left, value, comparator, txn);
+            return copy;
+        }
+        if (comparator(key(tr), value)) {
+            auto copy = txn.copy(tr);
+            copy->right = erase(tr->right, value, comparator, txn);
+            return copy;
+        }
+        txn.retired.push_back(tr);
+        return merge(tr->left, tr->right, txn);
+    }
+
+    // O(n), read-only; visit(value) in key order
+    template <typename F>
+    static void for_each(node_t const* tr, F& visit) {
+        while (tr != nullptr) {
+            for_each(tr->left, visit);
+            visit(*tr->value);
+            tr = tr->right;
+        }
+    }
+
+    // O(n) nothrow, no readers
+    template <typename F>
+    static void destroy(node_t const* tr, F on_value) {
+        while (tr != nullptr) {
+            if (tr->left != nullptr) {
+                // rotate the left subtree up to free the tree without
+                // recursion or extra memory
+                auto l = const_cast<node_t*>(tr->left);
+                const_cast<node_t*>(tr)->left = l->right;
+                l->right = tr;
+                tr = l;
+            }
+            else {
+                auto next = tr->right;
+                on_value(tr->value);
+                delete tr;
+                tr = next;
+            }
+        }
+    }
+};
+} // namespace persistent
+
+// bimap, у которого поиск можно выполнять из любого числа потоков без
+// блокировок, а изменять -- из одного потока за раз (писатели
+// сериализуются мьютексом).
+//
+// Каждое изменение копирует путь от корня до измененного места и атомарно
+// публикует новую версию, поэтому читатель всегда видит согласованное
+// состояние обеих сторон. Старые узлы освобождаются, когда их гарантированно
+// не видит ни один читатель.
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+    typename CompareRight = std::less<Right>>
+struct concurrent_bimap {
+    using value_type = std::pair<Left const, Right const>;
+
+private:
+    static Left const& get_left(value_type const& value) {
+        return value.first;
+    }
+
+    static Right const& get_right(value_type const& value) {
+        return value.second;
+    }
+
+    using node_t = persistent::node<value_type>;
+    using left_treap = persistent::treap<value_type, Left, &get_left, CompareLeft>;
+    using right_treap =
+        persistent::treap<value_type, Right, &get_right, CompareRight>;
+
+    struct version {
+        node_t const* left;
+        node_t const* right;
+        std::size_t size;
+        // number of the update that published this version
+        std::uint64_t seq;
+    };
+
+    struct garbage {
+        std::vector<node_t const*> nodes;
+        std::vector<value_type const*> values;
+        std::vector<version const*> versions;
+        // everything here is reachable from versions up to this one only
+        std::uint64_t last{ 0 };
+
+        void release() noexcept {
+            for (auto* p : nodes) {
+                delete p;
+            }
+            for (auto* p : values) {
+                delete p;
+            }
+            for (auto* p : versions) {
+                delete p;
+            }
+            nodes.clear();
+            values.clear();
+            versions.clear();
+            last = 0;
+        }
+    };
+
+    // lookups over one version, shared by read_view and snapshot_view
+    struct view_base {
+        // Возвращает пару по элементу. Если не найден -- nullptr
+        value_type const* find_left(Left const& left) const {
+            return value(left_treap::find(v->left, left, owner->left_cmp));
+        }
+
+        value_type const* find_right(Right const& right) const {
+            return value(right_treap::find(v->right, right, owner->right_cmp));
+        }
+
+        // Возвращает противоположный элемент по элементу
+        // Если элемента не существует -- бросает std::out_of_range
+        Right const& at_left(Left const& key) const {
+            auto res = find_left(key);
+            if (res == nullptr) {
+                throw std::out_of_range("");
+            }
+            return res->second;
+        }
+
+        Left const& at_right(Right const& key) const {
+            auto res = find_right(key);
+            if (res == nullptr) {
+                throw std::out_of_range("");
+            }
+            return res->first;
+        }
+
+        value_type const* lower_bound_left(Left const& left) const {
+            return value(left_treap::lower_bound(v->left, left, owner->left_cmp));
+        }
+
+        value_type const* upper_bound_left(Left const& left) const {
+            return value(left_treap::upper_bound(v->left, left, owner->left_cmp));
+        }
+
+        value_type const* lower_bound_right(Right const& right) const {
+            return value(
+                right_treap::lower_bound(v->right, right, owner->right_cmp));
+        }
+
+        value_type const* upper_bound_right(Right const& right) const {
+            return value(
+                right_treap::upper_bound(v->right, right, owner->right_cmp));
+        }
+
+        bool empty() const {
+            return v->size == 0;
+        }
+
+        std::size_t size() const {
+            return v->size;
+        }
+
+        // Вызывает visit(left, right) для всех пар в порядке левых ключей
+        template <typename F>
+        void for_each_left(F visit) const {
+            auto pass = [&](value_type const& value) {
+                visit(value.first, value.second);
+            };
+            left_treap::for_each(v->left, pass);
+        }
+
+        // Вызывает visit(right, left) для всех пар в порядке правых ключей
+        template <typename F>
+        void for_each_right(F visit) const {
+            auto pass = [&](value_type const& value) {
+                visit(value.second, value.first);
+            };
+            right_treap::for_each(v->right, pass);
+        }
+
+    protected:
+        explicit view_base(concurrent_bimap const& owner) : owner(&owner) {}
+
+        static value_type const* value(node_t const* tr) {
+            return tr == nullptr ? nullptr : tr->value;
+        }
+
+        concurrent_bimap const* owner;
+        version const* v{ nullptr };
+    };
+
+public:
+    // Согласованный снимок для чтения. Пока он жив, все возвращенные
+    // им ссылки и указатели остаются валидными. Рассчитан на короткие
+    // чтения: пока он жив, память старых версий не освобождается.
+    struct read_view : view_base {
+    private:
+        friend struct concurrent_bimap;
+
+        explicit read_view(concurrent_bimap const& owner)
+            : view_base(owner), g(owner.domain) {
+            this->v = owner.current.load();
+        }
+
+        persistent::epoch_domain::guard g;
+    };
+
+    // Снимок для долгих чтений (например, построения отчетов): стоит O(1)
+    // и не мешает писателю. Пока он жив, удерживаются только узлы,
+    // замененные после его создания, -- O(log n) на изменение. Можно
+    // передавать между потоками, но он не должен пережить bimap.
+    struct snapshot_view : view_base {
+        snapshot_view(snapshot_view&& other) noexcept : view_base(other) {
+            other.owner = nullptr;
+        }
+
+        snapshot_view(snapshot_view const&) = delete;
+        snapshot_view& operator=(snapshot_view const&) = delete;
+        snapshot_view& operator=(snapshot_view&&) = delete;
+
+        ~snapshot_view() {
+            if (this->owner != nullptr) {
+                std::lock_guard<std::mutex> lock(this->owner->pins_lock);
+                auto& pins = this->owner->pins;
+                pins.erase(pins.find(this->v->seq));
+            }
+        }
+
+    private:
+        friend struct concurrent_bimap;
+
+        explicit snapshot_view(concurrent_bimap const& owner)
+            : view_base(owner) {
+            // the epoch guard keeps the version alive until it is pinned
+            persistent::epoch_domain::guard g(owner.domain);
+            this->v = owner.current.load();
+            std::lock_guard<std::mutex> lock(owner.pins_lock);
+            owner.pins.insert(this->v->seq);
+        }
+    };
+
+    // Создает bimap не содержащий ни одной пары.
+    concurrent_bimap(CompareLeft left_cmp = CompareLeft(),
+        CompareRight right_cmp = CompareRight())
+        : left_cmp(std::move(left_cmp)), right_cmp(std::move(right_cmp)),
+        current(new version{ nullptr, nullptr, 0, 0 }) {}
+
+    concurrent_bimap(concurrent_bimap const&) = delete;
+    concurrent_bimap& operator=(concurrent_bimap const&) = delete;
+
+    // Требует, чтобы ни один поток больше не читал и не осталось снимков.
+    ~concurrent_bimap() {
+        auto v = current.load();
+        // каждое значение достижимо ровно из одного левого узла
+        left_treap::destroy(v->left, [](value_type const* value) {
+            delete value;
+            });
+        right_treap::destroy(v->right, [](value_type const*) {});
+        delete v;
+        bin[0].release();
+        bin[1].release();
+    }
+
+    read_view read() const {
+        return read_view(*this);
+    }
+
+    snapshot_view snapshot() const {
+        return snapshot_view(*this);
+    }
+
+    // Вставка пары (left, right). Возвращает false, если такой left или
+    // right уже есть.
+    bool insert(Left left, Right right) {
+        std::lock_guard<std::mutex> lock(writer);
+        auto v = current.load(std::memory_order_relaxed);
+        if (left_treap::find(v->left, left, left_cmp) != nullptr ||
+            right_treap::find(v->right, right, right_cmp) != nullptr) {
+            return false;
+        }
+        auto value = new value_type(std::move(left), std::move(right));
+        persistent::transaction<value_type> txn;
+        try {
+            auto y = priorities();
+            auto l = left_treap::insert(v->left,
+                txn.make(node_t{ value, nullptr, nullptr, y }), left_cmp, txn);
+            auto r = right_treap::insert(v->right,
+                txn.make(node_t{ value, nullptr, nullptr, y }), right_cmp, txn);
+            publish(txn, new version{ l, r, v->size + 1, v->seq + 1 }, nullptr);
+        }
+        catch (...) {
+            txn.rollback();
+            delete value;
+            throw;
+        }
+        return true;
+    }
+
+    bool erase_left(Left const& left) {
+        std::lock_guard<std::mutex> lock(writer);
+        auto v = current.load(std::memory_order_relaxed);
+        auto tr = left_treap::find(v->left, left, left_cmp);
+        return tr != nullptr && erase(v, tr->value);
+    }
+
+    bool erase_right(Right const& right) {
+        std::lock_guard<std::mutex> lock(writer);
+        auto v = current.load(std::memory_order_relaxed);
+        auto tr = right_treap::find(v->right, right, right_cmp);
+        return tr != nullptr && erase(v, tr->value);
+    }
+
+    // Освобождает память старых версий, которые уже никто не читает и
+    // не удерживает снимками.
+    void reclaim() {
+        std::lock_guard<std::mutex> lock(writer);
+        collect();
+    }
+
+    std::optional<Right> find_left(Left const& left) const {
+        auto view = read();
+        auto res = view.find_left(left);
+        if (res == nullptr) {
+            return std::nullopt;
+        }
+        return res->second;
+    }
+
+    std::optional<Left> find_right(Right const& right) const {
+        auto view = read();
+        auto res = view.find_right(right);
+        if (res == nullptr) {
+            return std::nullopt;
+        }
+        return res->first;
+    }
+
+    Right at_left(Left const& key) const {
+        return read().at_left(key);
+    }
+
+    Left at_right(Right const& key) const {
+        return read().at_right(key);
+    }
+
+    std::optional<std::pair<Left, Right>> lower_bound_left(Left const& left) const {
+        auto view = read();
+        return copy(view.lower_bound_left(left));
+    }
+
+    std::optional<std::pair<Left, Right>> lower_bound_right(
+        Right const& right) const {
+        auto view = read();
+        return copy(view.lower_bound_right(right));
+    }
+
+    bool empty() const {
+        return read().empty();
+    }
+
+    std::size_t size() const {
+        return read().size();
+    }
+
+private:
+    static std::optional<std::pair<Left, Right>> copy(value_type const* value) {
+        if (value == nullptr) {
+            return std::nullopt;
+        }
+        return std::pair<Left, Right>(value->first, value->second);
+    }
+
+    bool erase(version const* v, value_type const* value) {
+        persistent::transaction<value_type> txn;
+        try {
+            auto l = left_treap::erase(v->left, value->first, left_cmp, txn);
+            auto r = right_treap::erase(v->right, value->second, right_cmp, txn);
+            publish(txn, new version{ l, r, v->size - 1, v->seq + 1 }, value);
+        }
+        catch (...) {
+            txn.rollback();
+            throw;
+        }
+        return true;
+    }
+
+    void publish(persistent::transaction<value_type>& txn, version* next,
+        value_type const* removed) {
+        auto& g = bin[domain.current_parity()];
+        try {
+            g.nodes.reserve(g.nodes.size() + txn.retired.size());
+            g.versions.reserve(g.versions.size() + 1);
+            g.values.reserve(g.values.size() + 1);
+        }
+        catch (...) {
+            delete next;
+            throw;
+        }
+        auto prev = current.load(std::memory_order_relaxed);
+        current.store(next);
+        g.nodes.insert(g.nodes.end(), txn.retired.begin(), txn.retired.end());
+        g.versions.push_back(prev);
+        g.last = prev->seq;
+        if (removed != nullptr) {
+            g.values.push_back(removed);
+        }
+        collect();
+    }
+
+    void collect() noexcept {
+        // двух продвижений эпохи достаточно, чтобы освободить только что
+        // снятое с публикации, если читателей нет
+        for (int i = 0; i < 2; i++) {
+            auto drained = domain.try_advance();
+            if (!drained) {
+                return;
+            }
+            // garbage seen by a snapshot stays and is joined by what is
+            // retired in the next epoch; last only grows, so it is tried
+            // again two advances later
+            if (!pinned(bin[*drained])) {
+                bin[*drained].release();
+            }
+        }
+    }
+
+    bool pinned(garbage const& g) const {
+        std::lock_guard<std::mutex> lock(pins_lock);
+        return !g.versions.empty() && !pins.empty() && *pins.begin() <= g.last;
+    }
+
+    CompareLeft left_cmp;
+    CompareRight right_cmp;
+    persistent::epoch_domain domain;
+    std::atomic<version const*> current;
+    std::mutex writer;
+    garbage bin[2];
+    // versions held by snapshots, by seq
+    mutable std::mutex pins_lock;
+    mutable std::multiset<std::uint64_t> pins;
+    // используется только под мьютексом писателя
+    intrusive::priority_generator priorities;
+};
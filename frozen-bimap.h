@@ -0,0 +1,705 @@
+#pragma once
+
+#include "bimap.h"
+#include "intrusive-set.h" // intrusive::prefetch, intrusive::is_three_way
+#include <algorithm>       // std::sort
+#include <bit>             // std::countr_one, std::popcount
+#include <climits>         // CHAR_BIT
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <functional> // std::less
+#include <iterator>
+#include <limits>
+#include <numeric> // std::iota
+#include <stdexcept>
+#include <type_traits>
+#include <utility> // std::pair, std::move
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512BW__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace frozen {
+
+using index_t = std::uint32_t;
+
+// Sorted keys in Eytzinger (breadth-first) order: the children of slot k
+// are 2k and 2k + 1, so the top levels share a few cache lines and every
+// level of the descent reads one predictable slot, which is prefetched
+// several levels ahead. ranks[k] is the sorted position of slot k, ranks[0]
+// stands for "past the end".
+template <typename Key, typename Compare>
+struct eytzinger_index : private Compare {
+    explicit eytzinger_index(Compare const& comparator = Compare())
+        : Compare(comparator), ranks(1, 0) {}
+
+    // O(n), key_at(i) is the i-th key in sorted order
+    template <typename KeyAt>
+    void assign(std::size_t n, KeyAt key_at) {
+        std::vector<Key> new_keys;
+        std::vector<index_t> new_ranks(n + 1);
+        new_ranks[0] = static_cast<index_t>(n);
+        fill(new_ranks, 1, 0);
+        new_keys.reserve(n);
+        for (std::size_t k = 1; k <= n; k++) {
+            new_keys.push_back(key_at(new_ranks[k]));
+        }
+        keys = std::move(new_keys);
+        ranks = std::move(new_ranks);
+    }
+
+    // O(log n) nothrow, sorted position of the first key not less than key
+    template <typename K>
+    index_t lower_bound(K const& key) const {
+        return ranks[descend([&](Key const& x) { return less(x, key); })];
+    }
+
+    template <typename K>
+    index_t upper_bound(K const& key) const {
+        return ranks[descend([&](Key const& x) { return !less(key, x); })];
+    }
+
+    // O(log n) nothrow, size() if absent
+    template <typename K>
+    index_t find(K const& key) const {
+        auto k = descend([&](Key const& x) { return less(x, key); });
+        return k != 0 && !less(key, keys[k - 1]) ? ranks[k] : ranks[0];
+    }
+
+    Compare const& comparator() const {
+        return *this;
+    }
+
+    template <typename A, typename B>
+    bool less(A const& a, B const& b) const {
+        if constexpr (three_way) {
+            return comparator()(a, b) < 0;
+        }
+        else {
+            return comparator()(a, b);
+        }
+    }
+
+private:
+    static constexpr bool three_way = intrusive::is_three_way<Compare, Key>::value;
+
+    // slots prefetched ahead: as many levels as fit into one cache line
+    static constexpr std::size_t prefetch_stride =
+        sizeof(Key) >= 64 ? 1 : std::bit_floor(64 / sizeof(Key));
+
+    // Returns the slot of the first key for which go_right is false, 0 if
+    // there is none.
+    template <typename GoRight>
+    std::size_t descend(GoRight go_right) const {
+        std::size_t n = keys.size(), k = 1;
+        while (k <= n) {
+            if (k * prefetch_stride <= n) {
+                intrusive::prefetch(keys.data() + k * prefetch_stride - 1);
+            }
+            k = 2 * k + go_right(keys[k - 1]);
+        }
+        return k >> (std::countr_one(k) + 1);
+    }
+
+    static index_t fill(std::vector<index_t>& ranks, std::size_t k, index_t i) {
+        if (k < ranks.size()) {
+            i = fill(ranks, 2 * k, i);
+            ranks[k] = i++;
+            i = fill(ranks, 2 * k + 1, i);
+        }
+        return i;
+    }
+
+    std::vector<Key> keys;
+    std::vector<index_t> ranks;
+};
+
+namespace simd {
+
+template <std::size_t Size>
+struct lane;
+
+template <>
+struct lane<1> {
+    using type = std::int8_t;
+};
+
+template <>
+struct lane<2> {
+    using type = std::int16_t;
+};
+
+template <>
+struct lane<4> {
+    using type = std::int32_t;
+};
+
+template <>
+struct lane<8> {
+    using type = std::int64_t;
+};
+
+// One B-tree node is one cache line of signed lanes.
+constexpr std::size_t node_bytes = 64;
+
+#if defined(__AVX512BW__) || defined(__AVX2__) || \
+    (defined(__ARM_NEON) && defined(__aarch64__))
+constexpr bool available = true;
+#else
+// the scalar node scan loses to the Eytzinger descent
+constexpr bool available = false;
+#endif
+
+// Number of keys in the node greater than x if KeysGreater, less than x
+// otherwise. Everything is a signed "greater than" compare of the whole
+// node against a broadcast x, the matching lanes are counted by popcount.
+template <bool KeysGreater, typename S>
+unsigned count_greater(S const* node, S x) {
+#if defined(__AVX512BW__)
+    auto keys = _mm512_load_si512(node);
+    __m512i key;
+    if constexpr (sizeof(S) == 1) {
+        key = _mm512_set1_epi8(x);
+        return std::popcount(KeysGreater ? _mm512_cmpgt_epi8_mask(keys, key)
+            : _mm512_cmpgt_epi8_mask(key, keys));
+    }
+    else if constexpr (sizeof(S) == 2) {
+        key = _mm512_set1_epi16(x);
+        return std::popcount(KeysGreater ? _mm512_cmpgt_epi16_mask(keys, key)
+            : _mm512_cmpgt_epi16_mask(key, keys));
+    }
+    else if constexpr (sizeof(S) == 4) {
+        key = _mm512_set1_epi32(x);
+        return std::popcount(static_cast<unsigned>(KeysGreater
+            ? _mm512_cmpgt_epi32_mask(keys, key) : _mm512_cmpgt_epi32_mask(key, keys)));
+    }
+    else {
+        key = _mm512_set1_epi64(x);
+        return std::popcount(static_cast<unsigned>(KeysGreater
+            ? _mm512_cmpgt_epi64_mask(keys, key) : _mm512_cmpgt_epi64_mask(key, keys)));
+    }
+#elif defined(__AVX2__)
+    auto greater = [](__m256i a, __m256i b) {
+        if constexpr (sizeof(S) == 1) {
+            return _mm256_cmpgt_epi8(a, b);
+        }
+        else if constexpr (sizeof(S) == 2) {
+            return _mm256_cmpgt_epi16(a, b);
+        }
+        else if constexpr (sizeof(S) == 4) {
+            return _mm256_cmpgt_epi32(a, b);
+        }
+        else {
+            return _mm256_cmpgt_epi64(a, b);
+        }
+    };
+    __m256i key;
+    if constexpr (sizeof(S) == 1) {
+        key = _mm256_set1_epi8(x);
+    }
+    else if constexpr (sizeof(S) == 2) {
+        key = _mm256_set1_epi16(x);
+    }
+    else if constexpr (sizeof(S) == 4) {
+        key = _mm256_set1_epi32(x);
+    }
+    else {
+        key = _mm256_set1_epi64x(x);
+    }
+    auto lo = _mm256_load_si256(reinterpret_cast<__m256i const*>(node));
+    auto hi = _mm256_load_si256(reinterpret_cast<__m256i const*>(node) + 1);
+    auto lo_mask = KeysGreater ? greater(lo, key) : greater(key, lo);
+    auto hi_mask = KeysGreater ? greater(hi, key) : greater(key, hi);
+    // one bit per byte, so every lane is counted sizeof(S) times
+    auto bytes = static_cast<std::uint64_t>(
+        static_cast<std::uint32_t>(_mm256_movemask_epi8(lo_mask))) |
+        static_cast<std::uint64_t>(
+            static_cast<std::uint32_t>(_mm256_movemask_epi8(hi_mask))) << 32;
+    return static_cast<unsigned>(std::popcount(bytes)) / sizeof(S);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    auto greater = [](S const* ptr, S value) {
+        if constexpr (sizeof(S) == 1) {
+            auto keys = vld1q_s8(ptr);
+            auto key = vdupq_n_s8(value);
+            return KeysGreater ? vcgtq_s8(keys, key) : vcgtq_s8(key, keys);
+        }
+        else if constexpr (sizeof(S) == 2) {
+            auto keys = vld1q_s16(ptr);
+            auto key = vdupq_n_s16(value);
+            return vreinterpretq_u8_u16(
+                KeysGreater ? vcgtq_s16(keys, key) : vcgtq_s16(key, keys));
+        }
+        else if constexpr (sizeof(S) == 4) {
+            auto keys = vld1q_s32(ptr);
+            auto key = vdupq_n_s32(value);
+            return vreinterpretq_u8_u32(
+                KeysGreater ? vcgtq_s32(keys, key) : vcgtq_s32(key, keys));
+        }
+        else {
+            auto keys = vld1q_s64(ptr);
+            auto key = vdupq_n_s64(value);
+            return vreinterpretq_u8_u64(
+                KeysGreater ? vcgtq_s64(keys, key) : vcgtq_s64(key, keys));
+        }
+    };
+    constexpr std::size_t per_vector = 16 / sizeof(S);
+    unsigned bytes = 0;
+    for (std::size_t i = 0; i < node_bytes / 16; i++) {
+        bytes += vaddvq_u8(vshrq_n_u8(greater(node + i * per_vector, x), 7));
+    }
+    return bytes / sizeof(S);
+#else
+    unsigned res = 0;
+    for (std::size_t i = 0; i < node_bytes / sizeof(S); i++) {
+        res += KeysGreater ? node[i] > x : x > node[i];
+    }
+    return res;
+#endif
+}
+
+} // namespace simd
+
+// Implicit static B-tree for integral keys ordered by std::less: every node
+// holds one cache line of keys and is searched with a single vector
+// compare (AVX-512, AVX2 or NEON), so a lookup
+// costs about log_{B+1}(n) cache misses. Node k has children
+// k * (B + 1) + i + 1. The last node is padded with the maximal key whose
+// rank is "past the end". Unsigned keys are stored with the sign bit
+// flipped, so that signed compares order them correctly.
+template <typename Key, typename Compare>
+struct btree_index : private Compare {
+    explicit btree_index(Compare const& comparator = Compare())
+        : Compare(comparator) {}
+
+    // O(n), key_at(i) is the i-th key in sorted order
+    template <typename KeyAt>
+    void assign(std::size_t n, KeyAt key_at) {
+        std::vector<key_node> new_keys((n + B - 1) / B);
+        std::vector<rank_node> new_ranks(new_keys.size());
+        index_t next = 0;
+        fill(new_keys, new_ranks, 0, next, n, key_at);
+        keys = std::move(new_keys);
+        ranks = std::move(new_ranks);
+        size = static_cast<index_t>(n);
+    }
+
+    // O(log n) nothrow, sorted position of the first key not less than key
+    index_t lower_bound(Key key) const {
+        return rank(descend<false>(to_lane(key)));
+    }
+
+    index_t upper_bound(Key key) const {
+        return rank(descend<true>(to_lane(key)));
+    }
+
+    // O(log n) nothrow, size() if absent
+    index_t find(Key key) const {
+        auto x = to_lane(key);
+        auto res = descend<false>(x);
+        return res.node != npos && keys[res.node].keys[res.i] == x ? rank(res) : size;
+    }
+
+    Compare const& comparator() const {
+        return *this;
+    }
+
+    bool less(Key a, Key b) const {
+        return comparator()(a, b);
+    }
+
+private:
+    using lane_t = typename simd::lane<sizeof(Key)>::type;
+    using unsigned_lane_t = std::make_unsigned_t<lane_t>;
+
+    static constexpr std::size_t B = simd::node_bytes / sizeof(Key);
+    static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+    struct alignas(simd::node_bytes) key_node {
+        lane_t keys[B];
+    };
+
+    struct rank_node {
+        index_t ranks[B];
+    };
+
+    struct position {
+        std::size_t node;
+        std::size_t i;
+    };
+
+    static lane_t to_lane(Key key) {
+        if constexpr (std::is_unsigned_v<Key>) {
+            return static_cast<lane_t>(static_cast<unsigned_lane_t>(key) ^
+                (unsigned_lane_t(1) << (sizeof(Key) * CHAR_BIT - 1)));
+        }
+        else {
+            return static_cast<lane_t>(key);
+        }
+    }
+
+    static std::size_t child(std::size_t k, std::size_t i) {
+        return k * (B + 1) + i + 1;
+    }
+
+    // First key, in order, greater than x if Upper, not less than x
+    // otherwise; node == npos if there is none.
+    template <bool Upper>
+    position descend(lane_t x) const {
+        position res{ npos, 0 };
+        for (std::size_t k = 0; k < keys.size();) {
+            std::size_t i = Upper
+                ? B - simd::count_greater<true>(keys[k].keys, x)
+                : simd::count_greater<false>(keys[k].keys, x);
+            if (i < B) {
+                res = { k, i };
+            }
+            k = child(k, i);
+            if (k < keys.size()) {
+                intrusive::prefetch(&keys[k]);
+            }
+        }
+        return res;
+    }
+
+    index_t rank(position pos) const {
+        return pos.node == npos ? size : ranks[pos.node].ranks[pos.i];
+    }
+
+    template <typename KeyAt>
+    static void fill(std::vector<key_node>& keys, std::vector<rank_node>& ranks,
+        std::size_t k, index_t& next, std::size_t n, KeyAt& key_at) {
+        if (k >= keys.size()) {
+            return;
+        }
+        for (std::size_t i = 0; i < B; i++) {
+            fill(keys, ranks, child(k, i), next, n, key_at);
+            if (next < n) {
+                keys[k].keys[i] = to_lane(key_at(next));
+                ranks[k].ranks[i] = next++;
+            }
+            else {
+                keys[k].keys[i] = std::numeric_limits<lane_t>::max();
+                ranks[k].ranks[i] = static_cast<index_t>(n);
+            }
+        }
+        fill(keys, ranks, child(k, B), next, n, key_at);
+    }
+
+    std::vector<key_node> keys;
+    std::vector<rank_node> ranks;
+    index_t size{ 0 };
+};
+
+template <typename Key, typename Compare>
+struct uses_btree
+    : std::bool_constant<simd::available && std::is_integral_v<Key> &&
+    !std::is_same_v<Key, bool> &&
+    (std::is_same_v<Compare, std::less<Key>> ||
+        std::is_same_v<Compare, std::less<>>)> {};
+
+// Integral keys under std::less get the vectorized B-tree when the target
+// has vector compares, everything else the comparator-driven Eytzinger
+// layout.
+template <typename Key, typename Compare>
+using side_index = std::conditional_t<uses_btree<Key, Compare>::value,
+    btree_index<Key, Compare>, eytzinger_index<Key, Compare>>;
+
+} // namespace frozen
+
+// Неизменяемый bimap для таблиц, которые строятся один раз и потом только
+// читаются. Пары лежат одним массивом в порядке левых ключей, каждая
+// сторона ищется по своему непрерывному индексу (см. frozen::side_index),
+// который хранит копии ключей и номера пар. Итераторы ведут себя как у
+// bimap, включая flip(), и вдобавок произвольного доступа.
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+    typename CompareRight = std::less<Right>>
+struct frozen_bimap {
+    using left_t = Left;
+    using right_t = Right;
+
+private:
+    using index_t = frozen::index_t;
+
+    template <bool IsLeft>
+    struct frozen_iterator {
+        using value_type = std::conditional_t<IsLeft, Left, Right> const;
+        using iterator_category = std::random_access_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using pointer = value_type*;
+        using reference = value_type&;
+
+        frozen_iterator() = default;
+
+        reference operator*() const {
+            if constexpr (IsLeft) {
+                return map->pairs[pos].first;
+            }
+            else {
+                return map->pairs[map->right_order[pos]].second;
+            }
+        }
+
+        pointer operator->() const {
+            return &**this;
+        }
+
+        reference operator[](difference_type n) const {
+            return *(*this + n);
+        }
+
+        frozen_iterator& operator+=(difference_type n) {
+            pos = static_cast<index_t>(pos + n);
+            return *this;
+        }
+
+        frozen_iterator& operator-=(difference_type n) {
+            return *this += -n;
+        }
+
+        frozen_iterator& operator++() {
+            return *this += 1;
+        }
+
+        frozen_iterator operator++(int) {
+            frozen_iterator old = *this;
+            ++(*this);
+            return old;
+        }
+
+        frozen_iterator& operator--() {
+            return *this -= 1;
+        }
+
+        frozen_iterator operator--(int) {
+            frozen_iterator old = *this;
+            --(*this);
+            return old;
+        }
+
+        friend frozen_iterator operator+(frozen_iterator it, difference_type n) {
+            return it += n;
+        }
+
+        friend frozen_iterator operator+(difference_type n, frozen_iterator it) {
+            return it += n;
+        }
+
+        friend frozen_iterator operator-(frozen_iterator it, difference_type n) {
+            return it -= n;
+        }
+
+        friend difference_type operator-(frozen_iterator const& a,
+            frozen_iterator const& b) {
+            return static_cast<difference_type>(a.pos) -
+                static_cast<difference_type>(b.pos);
+        }
+
+        // end() одной стороны переходит в end() другой
+        frozen_iterator<!IsLeft> flip() const {
+            if constexpr (IsLeft) {
+                return frozen_iterator<false>(map, map->right_rank[pos]);
+            }
+            else {
+                return frozen_iterator<true>(map, map->right_order[pos]);
+            }
+        }
+
+        bool operator==(frozen_iterator const& other) const {
+            return pos == other.pos;
+        }
+
+        auto operator<=>(frozen_iterator const& other) const {
+            return pos <=> other.pos;
+        }
+
+    private:
+        friend struct frozen_bimap;
+
+        frozen_iterator(frozen_bimap const* map, index_t pos) : map(map), pos(pos) {}
+
+        frozen_bimap const* map{ nullptr };
+        index_t pos{ 0 };
+    };
+
+public:
+    using left_iterator = frozen_iterator<true>;
+    using right_iterator = frozen_iterator<false>;
+
+    // Создает пустой frozen_bimap
+    frozen_bimap(CompareLeft left_cmp = CompareLeft(),
+        CompareRight right_cmp = CompareRight())
+        : left_index(left_cmp), right_index(right_cmp), right_order(1, 0),
+        right_rank(1, 0) {}
+
+    // O(n log n): замораживает содержимое bimap, компараторы берутся у него
+    template <typename Allocator>
+    explicit frozen_bimap(
+        bimap<Left, Right, CompareLeft, CompareRight, Allocator> const& source)
+        : frozen_bimap(source.key_comp_left(), source.key_comp_right()) {
+        check_size(source.size());
+        pairs.reserve(source.size());
+        for (auto it = source.begin_left(); it != source.end_left(); ++it) {
+            pairs.emplace_back(*it, *it.flip());
+        }
+        build(false);
+    }
+
+    // O(n log n): строит из пар [first, last), отсортированных по левому
+    // ключу. Если левые ключи не строго возрастают или правые повторяются,
+    // бросает std::invalid_argument.
+    template <typename InputIt>
+    static frozen_bimap from_sorted(InputIt first, InputIt last,
+        CompareLeft left_cmp = CompareLeft(),
+        CompareRight right_cmp = CompareRight()) {
+        frozen_bimap res(std::move(left_cmp), std::move(right_cmp));
+        for (; first != last; ++first) {
+            res.pairs.emplace_back(first->first, first->second);
+            auto n = res.pairs.size();
+            if (n > 1 && !res.less_left(res.pairs[n - 2].first, res.pairs[n - 1].first)) {
+                throw std::invalid_argument("bimap: left keys are not sorted");
+            }
+        }
+        res.check_size(res.pairs.size());
+        res.build(true);
+        return res;
+    }
+
+    // Возвращает итератор по элементу. Если не найден - соответствующий end()
+    left_iterator find_left(Left const& left) const {
+        return left_iterator(this, left_index.find(left));
+    }
+
+    right_iterator find_right(Right const& right) const {
+        return right_iterator(this, right_index.find(right));
+    }
+
+    // Возвращает противоположный элемент по элементу
+    // Если элемента не существует -- бросает std::out_of_range
+    Right const& at_left(Left const& key) const {
+        return at(find_left(key), end_left());
+    }
+
+    Left const& at_right(Right const& key) const {
+        return at(find_right(key), end_right());
+    }
+
+    // lower и upper bound'ы по каждой стороне
+    left_iterator lower_bound_left(Left const& left) const {
+        return left_iterator(this, left_index.lower_bound(left));
+    }
+
+    left_iterator upper_bound_left(Left const& left) const {
+        return left_iterator(this, left_index.upper_bound(left));
+    }
+
+    right_iterator lower_bound_right(Right const& right) const {
+        return right_iterator(this, right_index.lower_bound(right));
+    }
+
+    right_iterator upper_bound_right(Right const& right) const {
+        return right_iterator(this, right_index.upper_bound(right));
+    }
+
+    left_iterator begin_left() const {
+        return left_iterator(this, 0);
+    }
+
+    left_iterator end_left() const {
+        return left_iterator(this, static_cast<index_t>(pairs.size()));
+    }
+
+    right_iterator begin_right() const {
+        return right_iterator(this, 0);
+    }
+
+    right_iterator end_right() const {
+        return right_iterator(this, static_cast<index_t>(pairs.size()));
+    }
+
+    bool empty() const {
+        return pairs.empty();
+    }
+
+    std::size_t size() const {
+        return pairs.size();
+    }
+
+    friend bool operator==(frozen_bimap const& a, frozen_bimap const& b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (std::size_t i = 0; i < a.size(); i++) {
+            if (!(a.pairs[i].first == b.pairs[i].first) ||
+                !(a.pairs[i].second == b.pairs[i].second)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    friend bool operator!=(frozen_bimap const& a, frozen_bimap const& b) {
+        return !(a == b);
+    }
+
+private:
+    static void check_size(std::size_t n) {
+        if (n >= std::numeric_limits<index_t>::max()) {
+            throw std::length_error("frozen_bimap: too many pairs");
+        }
+    }
+
+    bool less_left(Left const& a, Left const& b) const {
+        return left_index.less(a, b);
+    }
+
+    bool less_right(Right const& a, Right const& b) const {
+        return right_index.less(a, b);
+    }
+
+    // pairs уже отсортированы по левому ключу
+    void build(bool check_right) {
+        auto n = pairs.size();
+        right_order.resize(n + 1);
+        std::iota(right_order.begin(), right_order.end(), index_t(0));
+        std::sort(right_order.begin(), right_order.begin() + n,
+            [&](index_t a, index_t b) {
+                return less_right(pairs[a].second, pairs[b].second);
+            });
+        if (check_right) {
+            for (std::size_t i = 1; i < n; i++) {
+                if (!less_right(pairs[right_order[i - 1]].second,
+                    pairs[right_order[i]].second)) {
+                    throw std::invalid_argument("bimap: duplicate right key");
+                }
+            }
+        }
+        right_rank.resize(n + 1);
+        for (std::size_t i = 0; i <= n; i++) {
+            right_rank[right_order[i]] = static_cast<index_t>(i);
+        }
+        left_index.assign(n, [&](index_t i) -> Left const& { return pairs[i].first; });
+        right_index.assign(n, [&](index_t i) -> Right const& {
+            return pairs[right_order[i]].second;
+            });
+    }
+
+    template <typename Iterator>
+    static auto const& at(Iterator it, Iterator end) {
+        if (it == end) {
+            throw std::out_of_range("");
+        }
+        return *it.flip();
+    }
+
+    std::vector<std::pair<Left, Right>> pairs;
+    frozen::side_index<Left, CompareLeft> left_index;
+    frozen::side_index<Right, CompareRight> right_index;
+    // right_order[i] -- пара на i-й позиции правой стороны, right_rank --
+    // обратная перестановка; оба с лишним элементом n для end()
+    std::vector<index_t> right_order;
+    std::vector<index_t> right_rank;
+};
@@ -0,0 +1,430 @@
+#pragma once
+
+#include "intrusive-set.h" // intrusive::default_tag, intrusive::prefetch
+#include <algorithm>       // std::min, std::max, std::fill
+#include <cstddef>
+#include <cstdint>
+#include <functional> // std::equal_to
+#include <memory>      // std::allocator_traits
+#include <type_traits> // std::void_t
+#include <utility>     // std::swap
+#include <vector>
+
+namespace intrusive {
+
+// Side policy: index the key by Hash and KeyEqual instead of ordering it.
+// Takes the place of the comparator.
+template <typename Hash, typename KeyEqual = std::equal_to<>>
+struct hashed : Hash, KeyEqual {
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+
+    hashed(Hash const& hash = Hash(), KeyEqual const& equal = KeyEqual())
+        : Hash(hash), KeyEqual(equal) {}
+};
+
+template <typename U, typename T, typename Base, typename Tag, typename Policy,
+    typename Allocator>
+struct hash_set;
+
+// Allocator the bucket array of a hash_set is built with: the element
+// allocator rebound, unless it names another one for arrays of V as
+// Allocator::array_allocator<V>. A pool of fixed-size node blocks does,
+// so that bucket arrays neither take its block size nor keep it shared.
+template <typename Allocator, typename V, typename = void>
+struct array_allocator {
+    using type = typename std::allocator_traits<Allocator>::template rebind_alloc<V>;
+
+    static type make(Allocator const& allocator) {
+        return type(allocator);
+    }
+};
+
+template <typename Allocator, typename V>
+struct array_allocator<Allocator, V,
+    std::void_t<typename Allocator::template array_allocator<V>>> {
+    using type = typename Allocator::template array_allocator<V>;
+
+    static type make(Allocator const&) {
+        return type();
+    }
+};
+
+struct hash_element_base {
+    hash_element_base() = default;
+
+    hash_element_base(hash_element_base const& other) = delete;
+
+    template <typename U, typename T, typename Base, typename Tag,
+        typename Policy, typename Allocator>
+    friend struct hash_set;
+
+private:
+    hash_element_base* next{ nullptr };
+    std::size_t hash{ 0 };
+};
+
+template <typename Tag = default_tag>
+struct hash_element : hash_element_base {};
+
+// Intrusive hash set with chaining and stored hashes. All elements form one
+// singly linked list closed through the sentinel root, the elements of a
+// bucket are adjacent in it, and a bucket points to the element preceding
+// its first one, so insertion and erasure need no back links. Rehashing
+// reuses the stored hashes and never calls Hash. An empty set allocates
+// nothing.
+template <typename U, typename T, typename Base, typename Tag, typename Policy,
+    typename Allocator>
+struct hash_set : Policy {
+private:
+    using bucket_allocator =
+        typename array_allocator<Allocator, hash_element_base*>::type;
+
+    hash_element<Tag>* root;
+    hash_element_base* tail;
+    std::vector<hash_element_base*, bucket_allocator> buckets;
+    std::size_t count{ 0 };
+    unsigned shift{ 64 };
+
+public:
+    static Base& get_value(hash_element_base* tr) {
+        return (static_cast<T*>(
+            static_cast<U*>(static_cast<hash_element<Tag>*>(tr))))
+            ->elem;
+    }
+
+    static hash_element_base* get_next(hash_element_base* tr) {
+        return tr->next;
+    }
+
+    hash_set(hash_element<Tag>* root, Policy const& policy,
+        Allocator const& allocator = Allocator())
+        : Policy(policy), root(root), tail(root),
+        buckets(array_allocator<Allocator, hash_element_base*>::make(allocator)) {
+        root->next = root;
+    }
+
+    hash_set(hash_set const& other) = delete;
+
+    hash_set& operator=(hash_set const& other) = delete;
+
+    hash_element<Tag>* begin() const {
+        return static_cast<hash_element<Tag>*>(root->next);
+    }
+
+    hash_element<Tag>* end() const {
+        return root;
+    }
+
+    // Hash of the new element and the already present equivalent one.
+    struct insert_position {
+        std::size_t hash;
+        hash_element_base* existing;
+    };
+
+    // O(1) expected nothrow, read-only
+    insert_position find_position(key_arg_t<Base> value) const {
+        auto h = hash_of(value);
+        auto found = find(value, h);
+        return { h, found == root ? nullptr : found };
+    }
+
+    // O(n) strong, makes room for n elements so that insert_at does not
+    // rehash
+    void reserve(std::size_t n) {
+        if (n > buckets.size()) {
+            rehash(std::max<std::size_t>(n, 2 * buckets.size()));
+        }
+    }
+
+    // O(1) nothrow, pos must come from find_position with no changes since
+    // and the room for the element reserved
+    hash_element<Tag>* insert_at(insert_position const& pos, T* value) {
+        if (pos.existing != nullptr) {
+            return static_cast<hash_element<Tag>*>(pos.existing);
+        }
+        assert(count < buckets.size());
+        hash_element_base* tr = to_base(value);
+        tr->hash = pos.hash;
+        link(buckets, tr);
+        count++;
+        return static_cast<hash_element<Tag>*>(tr);
+    }
+
+    // O(1) expected
+    hash_element<Tag>* insert(T* value) {
+        auto pos = find_position(value->elem);
+        if (pos.existing == nullptr) {
+            reserve(count + 1);
+        }
+        return insert_at(pos, value);
+    }
+
+    // O(n), set must be empty. Copies the buckets and element order of
+    // other; clone(T*) returns the unlinked counterpart of an element of
+    // other. If clone throws, the elements cloned so far stay linked.
+    template <typename Clone>
+    void clone_from(hash_set const& other, Clone clone) {
+        buckets.assign(other.buckets.size(), nullptr);
+        shift = other.shift;
+        for (auto src = other.root->next; src != other.root; src = src->next) {
+            auto tr = to_base(clone(to_value(src)));
+            tr->hash = src->hash;
+            auto& bucket = buckets[index(tr->hash)];
+            if (bucket == nullptr) {
+                bucket = tail;
+            }
+            tr->next = root;
+            tail->next = tr;
+            tail = tr;
+            count++;
+        }
+    }
+
+    // O(n) nothrow, empties the set handing every element to dispose;
+    // the buckets are kept
+    template <typename Dispose>
+    void clear(Dispose dispose) {
+        auto tr = root->next;
+        detach_all();
+        while (tr != root) {
+            auto next = tr->next;
+            tr->next = nullptr;
+            dispose(to_value(tr));
+            tr = next;
+        }
+    }
+
+    // O(buckets) nothrow, forgets all elements without touching them
+    void detach_all() {
+        root->next = root;
+        tail = root;
+        count = 0;
+        std::fill(buckets.begin(), buckets.end(), nullptr);
+    }
+
+    // O(1) expected nothrow
+    void erase(hash_element_base* ptr) {
+        if (ptr == root) {
+            return;
+        }
+        auto b = index(ptr->hash);
+        auto prev = buckets[b];
+        while (prev->next != ptr) {
+            prev = prev->next;
+        }
+        auto next = ptr->next;
+        bool next_here = next != root && index(next->hash) == b;
+        if (!next_here) {
+            if (next != root) {
+                buckets[index(next->hash)] = prev;
+            }
+            if (prev == buckets[b]) {
+                buckets[b] = nullptr;
+            }
+        }
+        prev->next = next;
+        if (tail == ptr) {
+            tail = prev;
+        }
+        ptr->next = nullptr;
+        count--;
+    }
+
+    // O(1) expected nothrow, read-only
+    template <typename K>
+    hash_element<Tag>* find(K const& value) const {
+        return static_cast<hash_element<Tag>*>(find(value, hash_of(value)));
+    }
+
+    static constexpr std::size_t batch_width = 16;
+
+    // O(1) expected per key, read-only. Finds keys[0..n) in groups of
+    // batch_width, prefetching the buckets and then the chain heads of a
+    // group before scanning any of its chains. store(i, element) gets the
+    // result for keys[i], end() if absent.
+    template <typename K, typename Store>
+    void find_batch(K const* keys, std::size_t n, Store store) const {
+        std::size_t hashes[batch_width];
+        for (std::size_t first = 0; first < n; first += batch_width) {
+            std::size_t width = std::min(batch_width, n - first);
+            if (count == 0) {
+                for (std::size_t i = 0; i < width; i++) {
+                    store(first + i, end());
+                }
+                continue;
+            }
+            for (std::size_t i = 0; i < width; i++) {
+                hashes[i] = hash_of(keys[first + i]);
+                prefetch(&buckets[index(hashes[i])]);
+            }
+            for (std::size_t i = 0; i < width; i++) {
+                if (auto prev = buckets[index(hashes[i])]) {
+                    prefetch(prev->next);
+                }
+            }
+            for (std::size_t i = 0; i < width; i++) {
+                store(first + i, static_cast<hash_element<Tag>*>(
+                    find(keys[first + i], hashes[i])));
+            }
+        }
+    }
+
+    // O(n) nothrow if visit is, read-only. Calls visit(U*) for every
+    // element in list order, prefetching the one after.
+    template <typename Visit>
+    void for_each(Visit visit) const {
+        for (auto tr = root->next; tr != root;) {
+            auto next = tr->next;
+            prefetch(next);
+            visit(static_cast<U*>(static_cast<hash_element<Tag>*>(tr)));
+            tr = next;
+        }
+    }
+
+#ifdef BIMAP_STATS
+    // O(n) nothrow, read-only; comparisons are key_equal calls, there are
+    // no splits or merges
+    index_stats stats() const {
+        index_stats res = counters;
+        std::size_t total = 0;
+        std::size_t depth = 0;
+        std::size_t bucket = 0;
+        for (auto tr = root->next; tr != root; tr = tr->next) {
+            auto b = index(tr->hash);
+            depth = tr != root->next && b == bucket ? depth + 1 : 1;
+            bucket = b;
+            total += depth;
+            res.max_depth = std::max(res.max_depth, depth);
+        }
+        res.average_depth = count == 0 ? 0 : double(total) / double(count);
+        return res;
+    }
+#endif
+
+    void swap(hash_set& other) {
+        std::swap(static_cast<Policy&>(*this), static_cast<Policy&>(other));
+        std::swap(root->next, other.root->next);
+        std::swap(tail, other.tail);
+        buckets.swap(other.buckets);
+        std::swap(count, other.count);
+        std::swap(shift, other.shift);
+        relink_root();
+        other.relink_root();
+    }
+
+    friend void swap(hash_set& a, hash_set& b) noexcept {
+        a.swap(b);
+    }
+
+private:
+    static hash_element_base* to_base(T* value) {
+        return static_cast<hash_element<Tag>*>(static_cast<U*>(value));
+    }
+
+    static T* to_value(hash_element_base* tr) {
+        return static_cast<T*>(
+            static_cast<U*>(static_cast<hash_element<Tag>*>(tr)));
+    }
+
+#ifdef BIMAP_STATS
+    mutable index_stats counters;
+
+    counting<typename Policy::key_equal> key_equal_ref() const {
+        return { *this, counters.comparisons };
+    }
+#else
+    typename Policy::key_equal const& key_equal_ref() const {
+        return *this;
+    }
+#endif
+
+    template <typename K>
+    std::size_t hash_of(K const& value) const {
+        return static_cast<typename Policy::hasher const&>(*this)(value);
+    }
+
+    // Fibonacci hashing: the top bits of the product, so that weak hashes
+    // such as the identity std::hash of integers still spread.
+    std::size_t index(std::size_t h) const {
+        return index(h, shift);
+    }
+
+    static std::size_t index(std::size_t h, unsigned shift) {
+        auto x = static_cast<std::uint64_t>(h) * 0x9e3779b97f4a7c15ull;
+        return shift >= 64 ? 0 : static_cast<std::size_t>(x >> shift);
+    }
+
+    template <typename K>
+    hash_element_base* find(K const& value, std::size_t h) const {
+        if (count == 0) {
+            return root;
+        }
+        auto const& equal = key_equal_ref();
+        auto b = index(h);
+        auto prev = buckets[b];
+        if (prev == nullptr) {
+            return root;
+        }
+        for (auto tr = prev->next; tr != root && index(tr->hash) == b;
+            tr = tr->next) {
+            if (tr->hash == h && equal(get_value(tr), value)) {
+                return tr;
+            }
+        }
+        return root;
+    }
+
+    // links tr at the head of its bucket in `to`, or at the head of the
+    // whole list if the bucket is empty
+    void link(std::vector<hash_element_base*, bucket_allocator>& to,
+        hash_element_base* tr) {
+        auto& bucket = to[index(tr->hash)];
+        if (bucket != nullptr) {
+            tr->next = bucket->next;
+            bucket->next = tr;
+            return;
+        }
+        tr->next = root->next;
+        root->next = tr;
+        if (tr->next != root) {
+            to[index(tr->next->hash)] = tr;
+        }
+        else {
+            tail = tr;
+        }
+        bucket = root;
+    }
+
+    void rehash(std::size_t n) {
+        std::size_t capacity = 1;
+        unsigned new_shift = 64;
+        while (capacity < n) {
+            capacity *= 2;
+            new_shift--;
+        }
+        std::vector<hash_element_base*, bucket_allocator> to(
+            capacity, nullptr, buckets.get_allocator());
+        auto tr = root->next;
+        root->next = root;
+        tail = root;
+        shift = new_shift;
+        while (tr != root) {
+            auto next = tr->next;
+            link(to, tr);
+            tr = next;
+        }
+        buckets.swap(to);
+    }
+
+    void relink_root() {
+        if (count == 0) {
+            root->next = root;
+            tail = root;
+            return;
+        }
+        tail->next = root;
+        buckets[index(root->next->hash)] = root;
+    }
+};
+} // namespace intrusive
@@ -1,24 +1,117 @@
 #pragma once
 
-#include <cassert> // assert
+#include <algorithm> // std::min, std::max
+#include <cassert>   // assert
 #include <climits>
+#include <compare> // std::partial_ordering
+#include <cstdint>
 #include <iterator> // std::reverse_iterator
-#include <random>
+#include <type_traits>
 #include <utility> // std::pair, std::swap
 
 namespace intrusive {
 struct default_tag;
 
+inline void prefetch(void const* ptr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(ptr);
+#else
+    (void)ptr;
+#endif
+}
+
 template <typename U, typename T, typename Base, typename Tag = default_tag,
     typename Compare = std::less<Base>>
     struct set;
 
-struct set_element_base {
+#ifdef BIMAP_STATS
+// Counters and shape of an index, collected only when BIMAP_STATS is
+// defined. Depth is the number of nodes on the path from the top, or the
+// position within the bucket chain for a hash index.
+struct index_stats {
+    std::size_t splits{ 0 };
+    std::size_t merges{ 0 };
+    std::size_t comparisons{ 0 };
+    std::size_t max_depth{ 0 };
+    double average_depth{ 0 };
+};
+
+// Forwards to F counting the calls. Const lookups count too, so a table
+// under statistics must not be read from several threads.
+template <typename F>
+struct counting {
+    F const& function;
+    std::size_t& calls;
+
+    template <typename... Args>
+    decltype(auto) operator()(Args const&... args) const {
+        calls++;
+        return function(args...);
+    }
+};
+#endif
+
+// Compare is three-way when comparing two keys yields an ordering (like
+// std::compare_three_way) rather than a bool "less".
+template <typename Compare, typename Key, typename = void>
+struct is_three_way : std::false_type {};
+
+template <typename Compare, typename Key>
+struct is_three_way<Compare, Key,
+    std::void_t<std::invoke_result_t<Compare const&, Key const&, Key const&>>>
+    : std::is_convertible<
+    std::invoke_result_t<Compare const&, Key const&, Key const&>,
+    std::partial_ordering> {};
+
+// Keys that copy trivially and fit in two registers are taken by value by
+// the non-template lookups, so a call that is not inlined does not have to
+// spill the key to memory to pass its address.
+template <typename K>
+using key_arg_t = std::conditional_t<
+    std::is_trivially_copyable_v<K> && sizeof(K) <= 2 * sizeof(void*), K, K const&>;
+
+// xorshift32 with a lazily chosen seed, cheap enough to own one per thread
+// or per container instead of sharing a global engine
+struct priority_generator {
+    std::uint32_t operator()() {
+        if (state == 0) {
+            seed();
+        }
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
 
-    static std::default_random_engine engine;
-    static std::uniform_int_distribution<uint32_t> random_elem;
+private:
+    void seed() {
+        // splitmix64 of the generator address, distinct per thread and
+        // per container
+        auto x = static_cast<std::uint64_t>(
+            reinterpret_cast<std::uintptr_t>(this)) + 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        state = static_cast<std::uint32_t>(x) | 1;
+    }
+
+    std::uint32_t state{ 0 };
+};
 
-    set_element_base() : y(random_elem(engine)) {};
+// Treap priority of an element. An element linked into several sets
+// inherits it once and all of them share it; the sets find it through the
+// element type U.
+struct set_priority {
+    static thread_local priority_generator engine;
+
+    set_priority() : y(engine()) {}
+
+    std::uint32_t y;
+};
+
+struct set_element_base {
+
+    set_element_base() = default;
 
     set_element_base(set_element_base&& other) {
         std::swap(other.left, left);
@@ -51,7 +144,6 @@ private:
     set_element_base* parent{ nullptr };
     set_element_base* left{ nullptr };
     set_element_base* right{ nullptr };
-    int y;
 
     template <typename T, typename Tag>
     friend struct intrusive_list;
@@ -64,6 +156,33 @@ private:
 template <typename Tag = default_tag>
 struct set_element : set_element_base {};
 
+// Side policy: order by Compare and keep subtree sizes, so that the set can
+// answer rank and select queries in O(h). Takes the place of the comparator
+// and compares like it.
+template <typename Compare>
+struct ranked : Compare {
+    using comparator = Compare;
+
+    ranked(Compare const& comparator = Compare()) : Compare(comparator) {}
+};
+
+template <typename Compare>
+struct is_ranked : std::false_type {};
+
+template <typename Compare>
+struct is_ranked<ranked<Compare>> : std::true_type {};
+
+// Element of a set ordered by ranked<Compare>.
+template <typename Tag = default_tag>
+struct ranked_set_element : set_element<Tag> {
+    template <typename U, typename T, typename Base, typename Tag_,
+        typename Compare>
+    friend struct set;
+
+private:
+    std::size_t subtree_size{ 1 };
+};
+
 template <typename U, typename T, typename Base, typename Tag, typename Compare>
 struct set : Compare {
 public:
@@ -75,41 +194,155 @@ public:
             ->elem;
     }
 
+    static constexpr bool three_way = is_three_way<Compare, Base>::value;
+    static constexpr bool counted = is_ranked<Compare>::value;
+
+    // Comparisons go through key_compare() and splits and merges through
+    // note(), which only count under BIMAP_STATS.
+    enum class event { split, merge };
+
+#ifdef BIMAP_STATS
+private:
+    mutable index_stats counters;
+
+public:
+    using compare_ref = counting<Compare>;
+
+    compare_ref key_compare() const {
+        return { *this, counters.comparisons };
+    }
+
+    void note(event e) const {
+        (e == event::split ? counters.splits : counters.merges)++;
+    }
+#else
+    // an empty comparator travels as a value: nothing to load through
+    using compare_ref = std::conditional_t<std::is_empty_v<Compare> &&
+        std::is_trivially_copyable_v<Compare>, Compare, Compare const&>;
+
+    compare_ref key_compare() const {
+        return *this;
+    }
+
+    void note(event) const {}
+#endif
+
+    // Equivalence is derived from the comparator alone, operator== is
+    // never used.
+    template <typename C, typename A, typename B>
+    static bool less(C const& comparator, A const& a, B const& b) {
+        if constexpr (three_way) {
+            return comparator(a, b) < 0;
+        }
+        else {
+            return comparator(a, b);
+        }
+    }
+
+    static std::uint32_t& priority(set_element_base* tr) {
+        return static_cast<set_priority*>(
+            static_cast<U*>(static_cast<set_element<Tag>*>(tr)))->y;
+    }
+
+    static set_element_base* to_base(T* value) {
+        return static_cast<set_element<Tag>*>(static_cast<U*>(value));
+    }
+
+    static T* to_value(set_element_base* tr) {
+        return static_cast<T*>(
+            static_cast<U*>(static_cast<set_element<Tag>*>(tr)));
+    }
+
+    // Subtree sizes exist only in counted sets, elsewhere these are no-ops.
+    static std::size_t& subtree_size(set_element_base* tr) {
+        return static_cast<ranked_set_element<Tag>*>(
+            static_cast<set_element<Tag>*>(tr))->subtree_size;
+    }
+
+    static std::size_t size_of(set_element_base* tr) {
+        return tr == nullptr ? 0 : subtree_size(tr);
+    }
+
+    static void recount(set_element_base* tr) {
+        if constexpr (counted) {
+            subtree_size(tr) = size_of(tr->left) + size_of(tr->right) + 1;
+        }
+    }
+
+    // O(h) nothrow. Top-down: every visited node is appended to the right
+    // spine of the lower part or the left spine of the upper part.
+    template <typename K, typename C>
     static std::pair<set_element_base*, set_element_base*>
-        split(set_element_base* tr, Base const& value, Compare const& comparator,
+        split(set_element_base* tr, K const& value, C const& comparator,
             bool lower = true) {
-        if (tr == nullptr) {
-            return { nullptr, nullptr };
+        set_element_base* head = nullptr;
+        set_element_base* tail = nullptr;
+        set_element_base** head_slot = &head;
+        set_element_base** tail_slot = &tail;
+        set_element_base* head_parent = nullptr;
+        set_element_base* tail_parent = nullptr;
+        while (tr != nullptr) {
+            if (lower ? !less(comparator, get_value(tr), value)
+                : less(comparator, value, get_value(tr))) {
+                *tail_slot = tr;
+                tr->parent = tail_parent;
+                tail_parent = tr;
+                tail_slot = &tr->left;
+                tr = tr->left;
+            }
+            else {
+                *head_slot = tr;
+                tr->parent = head_parent;
+                head_parent = tr;
+                head_slot = &tr->right;
+                tr = tr->right;
+            }
         }
-        if ((comparator(value, get_value(tr))) ||
-            (lower && value == get_value(tr))) {
-            auto p = split(tr->left, value, comparator, lower);
-            set_left(tr, p.second);
-            return { p.first, tr };
+        *head_slot = nullptr;
+        *tail_slot = nullptr;
+        // only the spines were relinked
+        for (; head_parent != nullptr; head_parent = head_parent->parent) {
+            recount(head_parent);
         }
-        else {
-            auto p = split(tr->right, value, comparator, lower);
-            set_right(tr, p.first);
-            return { tr, p.second };
+        for (; tail_parent != nullptr; tail_parent = tail_parent->parent) {
+            recount(tail_parent);
         }
+        return { head, tail };
     }
 
+    // O(h) nothrow, every element of left precedes every element of right
     static set_element_base* merge(set_element_base* left,
         set_element_base* right) {
-        if (!left || !right) {
-            if (left) {
-                return left;
+        set_element_base* res = nullptr;
+        set_element_base** slot = &res;
+        set_element_base* parent = nullptr;
+        while (left != nullptr && right != nullptr) {
+            if constexpr (counted) {
+                // the node taken down next ends up above both remainders
+                auto total = subtree_size(left) + subtree_size(right);
+                subtree_size(priority(left) < priority(right) ? left : right) = total;
+            }
+            if (priority(left) < priority(right)) {
+                *slot = left;
+                left->parent = parent;
+                parent = left;
+                slot = &left->right;
+                left = left->right;
+            }
+            else {
+                *slot = right;
+                right->parent = parent;
+                parent = right;
+                slot = &right->left;
+                right = right->left;
             }
-            return right;
-        }
-        if (left->y < right->y) {
-            set_right(left, merge(left->right, right));
-            return left;
         }
-        else {
-            set_left(right, merge(left, right->left));
-            return right;
+        auto rest = left != nullptr ? left : right;
+        *slot = rest;
+        if (rest != nullptr) {
+            rest->parent = parent;
         }
+        return res;
     }
 
     static set_element_base* get_min(set_element_base* tr) {
@@ -172,6 +405,28 @@ public:
         }
     }
 
+    // Lifts tr above its parent keeping the in-order sequence.
+    static void rotate_up(set_element_base* tr) {
+        auto p = tr->parent;
+        auto g = p->parent;
+        if (p->left == tr) {
+            set_left(p, tr->right);
+            set_right(tr, p);
+        }
+        else {
+            set_right(p, tr->left);
+            set_left(tr, p);
+        }
+        if (g->left == p) {
+            set_left(g, tr);
+        }
+        else {
+            set_right(g, tr);
+        }
+        recount(p);
+        recount(tr);
+    }
+
 public:
     set() : root(nullptr), Compare(Compare()) {}
 
@@ -204,20 +459,214 @@ public:
         return const_cast<set_element<Tag>*>(root);
     }
 
+    // Where a new element goes: the leaf slot under parent, or the already
+    // present equivalent element.
+    struct insert_position {
+        set_element_base* parent;
+        bool left;
+        set_element_base* existing;
+    };
+
+    // O(h) nothrow, read-only
+    insert_position find_position(key_arg_t<Base> value) const {
+        compare_ref comparator = key_compare();
+        set_element_base* candidate = nullptr;
+        insert_position pos{ root, true, nullptr };
+        set_element_base* tr = root->left;
+        while (tr != nullptr) {
+            pos.parent = tr;
+            if constexpr (three_way) {
+                auto order = comparator(get_value(tr), value);
+                if (order == 0) {
+                    pos.existing = tr;
+                    return pos;
+                }
+                pos.left = order > 0;
+            }
+            else {
+                pos.left = !comparator(get_value(tr), value);
+                if (pos.left) {
+                    candidate = tr;
+                }
+            }
+            tr = pos.left ? tr->left : tr->right;
+        }
+        if constexpr (!three_way) {
+            if (candidate != nullptr && !comparator(value, get_value(candidate))) {
+                pos.existing = candidate;
+            }
+        }
+        return pos;
+    }
+
+    // O(h) nothrow, pos must come from find_position with no changes since
+    set_element<Tag>* insert_at(insert_position const& pos, T* value) {
+        if (pos.existing != nullptr) {
+            return static_cast<set_element<Tag>*>(pos.existing);
+        }
+        set_element_base* tr = to_base(value);
+        if (pos.left) {
+            set_left(pos.parent, tr);
+        }
+        else {
+            set_right(pos.parent, tr);
+        }
+        if constexpr (counted) {
+            subtree_size(tr) = 1;
+            for (auto p = pos.parent; p != root; p = p->parent) {
+                subtree_size(p)++;
+            }
+        }
+        while (tr->parent != root && priority(tr) < priority(tr->parent)) {
+            rotate_up(tr);
+        }
+        return static_cast<set_element<Tag>*>(tr);
+    }
+
+    // O(1) nothrow, a treap needs no room ahead of insert_at
+    void reserve(std::size_t) {}
+
     // O(h) nothrow
     set_element<Tag>* insert(T* value) {
-        auto p = split(root->left, value->elem,
-            *static_cast<Compare*>(const_cast<set*>(this)));
-        auto p1 = split(p.second, value->elem,
-            *static_cast<Compare*>(const_cast<set*>(this)), false);
-        auto tmp = p1.first;
-        if (p1.first == nullptr) {
-            tmp = static_cast<set_element_base*>(
-                static_cast<set_element<Tag>*>(static_cast<U*>(value)));
+        return insert_at(find_position(value->elem), value);
+    }
+
+    // O(n) nothrow, set must be empty, [first, last) holds T* strictly
+    // increasing by the comparator; links they may keep from a former set
+    // are overwritten
+    template <typename InputIt>
+    void build_sorted(InputIt first, InputIt last) {
+        // Cartesian tree construction; the right spine built so far is
+        // reachable through parent links, so it doubles as the stack
+        set_element_base* spine = root;
+        for (; first != last; ++first) {
+            set_element_base* tr = to_base(*first);
+            tr->right = nullptr;
+            set_element_base* child = nullptr;
+            while (spine != root && priority(tr) < priority(spine)) {
+                // leaves the spine with its subtree complete
+                recount(spine);
+                child = spine;
+                spine = spine->parent;
+            }
+            set_left(tr, child);
+            if (spine == root) {
+                set_left(root, tr);
+            }
+            else {
+                set_right(spine, tr);
+            }
+            spine = tr;
+        }
+        for (; spine != root; spine = spine->parent) {
+            recount(spine);
+        }
+    }
+
+    // O(n), set must be empty. Copies the shape and priorities of other;
+    // clone(T*) returns the unlinked counterpart of an element of other.
+    // If clone throws, the elements cloned so far stay linked.
+    template <typename Clone>
+    void clone_from(set const& other, Clone clone) {
+        // walk both trees in lockstep; a missing child in the copy marks
+        // a subtree that still has to be visited
+        set_element_base* src = other.root;
+        set_element_base* dst = root;
+        for (;;) {
+            if (src->left != nullptr && dst->left == nullptr) {
+                auto tr = to_base(clone(to_value(src->left)));
+                priority(tr) = priority(src->left);
+                if constexpr (counted) {
+                    subtree_size(tr) = subtree_size(src->left);
+                }
+                set_left(dst, tr);
+                src = src->left;
+                dst = tr;
+            }
+            else if (src->right != nullptr && dst->right == nullptr) {
+                auto tr = to_base(clone(to_value(src->right)));
+                priority(tr) = priority(src->right);
+                if constexpr (counted) {
+                    subtree_size(tr) = subtree_size(src->right);
+                }
+                set_right(dst, tr);
+                src = src->right;
+                dst = tr;
+            }
+            else if (src == other.root) {
+                return;
+            }
+            else {
+                src = src->parent;
+                dst = dst->parent;
+            }
+        }
+    }
+
+    // O(n) nothrow, empties the set handing every element to dispose in
+    // post-order, without restoring the treap along the way
+    template <typename Dispose>
+    void clear(Dispose dispose) {
+        set_element_base* tr = root->left;
+        while (tr != nullptr) {
+            if (tr->left != nullptr) {
+                tr = tr->left;
+            }
+            else if (tr->right != nullptr) {
+                tr = tr->right;
+            }
+            else {
+                auto parent = tr->parent;
+                if (parent->left == tr) {
+                    parent->left = nullptr;
+                }
+                else {
+                    parent->right = nullptr;
+                }
+                tr->unlink();
+                dispose(to_value(tr));
+                tr = parent == root ? nullptr : parent;
+            }
         }
-        p.second = merge(tmp, p1.second);
-        set_left(root, merge(p.first, p.second));
-        return static_cast<set_element<Tag>*>(tmp);
+    }
+
+    // O(1) nothrow, forgets all elements without touching them; they must
+    // be disposed of through another set.
+    void detach_all() {
+        root->left = nullptr;
+    }
+
+    // O(h) nothrow, moves every element not less than value into the
+    // empty set upper
+    template <typename K>
+    void split_into(K const& value, set& upper) {
+        note(event::split);
+        auto parts = split(root->left, value, key_compare());
+        set_left(root, parts.first);
+        set_left(upper.root, parts.second);
+    }
+
+    // O(h) nothrow, moves the elements of [first, last) into the empty set
+    // out
+    void cut(set_element_base* first, set_element_base* last, set& out) {
+        note(event::split);
+        auto lower = split(root->left, get_value(first), key_compare());
+        auto upper = std::pair<set_element_base*, set_element_base*>(lower.second, nullptr);
+        if (last != root) {
+            note(event::split);
+            upper = split(lower.second, get_value(last), key_compare());
+        }
+        note(event::merge);
+        set_left(root, merge(lower.first, upper.second));
+        set_left(out.root, upper.first);
+    }
+
+    // O(h) nothrow, every element of other must follow every element of
+    // this set; moves them all here
+    void join(set& other) {
+        note(event::merge);
+        set_left(root, merge(root->left, other.root->left));
+        other.root->left = nullptr;
     }
 
     // O(h) nothrow
@@ -225,45 +674,353 @@ public:
         if (ptr == root) {
             return;
         }
+        note(event::merge);
         if (ptr->parent->left == ptr) {
             set_left(ptr->parent, merge(ptr->left, ptr->right));
         }
         else {
             set_right(ptr->parent, merge(ptr->left, ptr->right));
         }
+        if constexpr (counted) {
+            for (auto p = ptr->parent; p != root; p = p->parent) {
+                subtree_size(p)--;
+            }
+        }
         ptr->unlink();
         return;
     }
 
-    // O(h) strong
-    set_element<Tag>* find(Base const& value) const {
-        auto it = lower_bound(value);
-        if (it != end() && get_value(it) == value) {
-            return it;
+    // Order statistics, counted sets only. The static ones work from an
+    // element alone, the sentinel being the only node without a parent.
+
+    // O(h) nothrow, the k-th element in order counting from 0, the
+    // sentinel if there are no more than k elements
+    static set_element_base* select(set_element_base* sentinel, std::size_t k)
+        requires counted {
+        set_element_base* tr = sentinel->left;
+        while (tr != nullptr) {
+            auto before = size_of(tr->left);
+            if (k == before) {
+                return tr;
+            }
+            if (k < before) {
+                tr = tr->left;
+            }
+            else {
+                k -= before + 1;
+                tr = tr->right;
+            }
+        }
+        return sentinel;
+    }
+
+    // O(h) nothrow, number of elements preceding ptr, the size for the
+    // sentinel
+    static std::size_t rank_of(set_element_base* ptr)
+        requires counted {
+        if (ptr->parent == nullptr) {
+            return size_of(ptr->left);
+        }
+        auto res = size_of(ptr->left);
+        for (; ptr->parent->parent != nullptr; ptr = ptr->parent) {
+            if (ptr->parent->right == ptr) {
+                res += size_of(ptr->parent->left) + 1;
+            }
+        }
+        return res;
+    }
+
+    // O(h) nothrow, the element n positions away from ptr
+    static set_element_base* advance(set_element_base* ptr, std::ptrdiff_t n)
+        requires counted {
+        auto sentinel = ptr;
+        while (sentinel->parent != nullptr) {
+            sentinel = sentinel->parent;
         }
-        return end();
+        return select(sentinel, rank_of(ptr) + n);
+    }
+
+    // O(h) nothrow, end() if there are no more than k elements
+    set_element<Tag>* nth(std::size_t k) const
+        requires counted {
+        return static_cast<set_element<Tag>*>(select(root, k));
     }
 
-    set_element<Tag>* lower_bound(Base const& value) const {
-        auto p = split(root->left, value,
-            *static_cast<Compare*>(const_cast<set*>(this)));
-        auto m = get_min(p.second);
-        auto res = m == nullptr ? end() : static_cast<set_element<Tag>*>(m);
-        set_left(const_cast<set_element<Tag>*>(root), merge(p.first, p.second));
+    // O(h) nothrow, number of elements less than value, or not greater if
+    // !lower
+    template <typename K>
+    std::size_t count_before(K const& value, bool lower = true) const
+        requires counted {
+        compare_ref comparator = key_compare();
+        std::size_t res = 0;
+        set_element_base* tr = root->left;
+        while (tr != nullptr) {
+            if (lower ? less(comparator, get_value(tr), value)
+                : !less(comparator, value, get_value(tr))) {
+                res += size_of(tr->left) + 1;
+                tr = tr->right;
+            }
+            else {
+                tr = tr->left;
+            }
+        }
         return res;
     }
 
-    set_element<Tag>* upper_bound(Base const& value) const {
-        auto it = lower_bound(value);
-        if (it != end()) {
-            if (get_value(it) == value) {
-                it++;
+    // Lookups take any key type the comparator accepts next to Base; the
+    // container decides which ones to expose.
+
+    // O(h) nothrow, read-only; one comparison per visited node
+    template <typename K>
+    set_element<Tag>* find(K const& value) const {
+        compare_ref comparator = key_compare();
+        if constexpr (three_way) {
+            set_element_base* tr = root->left;
+            while (tr != nullptr) {
+                auto order = comparator(value, get_value(tr));
+                if (order == 0) {
+                    return static_cast<set_element<Tag>*>(tr);
+                }
+                tr = order < 0 ? tr->left : tr->right;
+            }
+            return end();
+        }
+        else {
+            auto it = lower_bound(value);
+            if (it != end() && !comparator(value, get_value(it))) {
+                return it;
             }
+            return end();
         }
-        return it;
     }
 
+    // O(h) nothrow, read-only
+    template <typename K>
+    set_element<Tag>* lower_bound(K const& value) const {
+        compare_ref comparator = key_compare();
+        set_element_base* res = root;
+        set_element_base* tr = root->left;
+        while (tr != nullptr) {
+            if constexpr (three_way) {
+                auto order = comparator(get_value(tr), value);
+                if (order == 0) {
+                    return static_cast<set_element<Tag>*>(tr);
+                }
+                if (order < 0) {
+                    tr = tr->right;
+                    continue;
+                }
+            }
+            else if (comparator(get_value(tr), value)) {
+                tr = tr->right;
+                continue;
+            }
+            res = tr;
+            tr = tr->left;
+        }
+        return static_cast<set_element<Tag>*>(res);
+    }
+
+    static constexpr std::size_t batch_width = 16;
+
+    // O(h) per key, read-only. Finds keys[0..n) descending for up to
+    // batch_width of them in lockstep and prefetching each next node, so
+    // the cache misses of different lookups overlap. store(i, element) gets
+    // the result for keys[i], end() if absent.
+    template <typename K, typename Store>
+    void find_batch(K const* keys, std::size_t n, Store store) const {
+        compare_ref comparator = key_compare();
+        set_element_base* cur[batch_width];
+        set_element_base* candidate[batch_width];
+        for (std::size_t first = 0; first < n; first += batch_width) {
+            std::size_t width = std::min(batch_width, n - first);
+            for (std::size_t i = 0; i < width; i++) {
+                cur[i] = root->left;
+                candidate[i] = nullptr;
+            }
+            for (bool active = true; active;) {
+                active = false;
+                for (std::size_t i = 0; i < width; i++) {
+                    auto tr = cur[i];
+                    if (tr == nullptr) {
+                        continue;
+                    }
+                    K const& key = keys[first + i];
+                    if constexpr (three_way) {
+                        auto order = comparator(key, get_value(tr));
+                        if (order == 0) {
+                            candidate[i] = tr;
+                            tr = nullptr;
+                        }
+                        else {
+                            tr = order < 0 ? tr->left : tr->right;
+                        }
+                    }
+                    else if (comparator(get_value(tr), key)) {
+                        tr = tr->right;
+                    }
+                    else {
+                        candidate[i] = tr;
+                        tr = tr->left;
+                    }
+                    if (tr != nullptr) {
+                        prefetch(tr);
+                        prefetch(&get_value(tr));
+                        active = true;
+                    }
+                    cur[i] = tr;
+                }
+            }
+            for (std::size_t i = 0; i < width; i++) {
+                auto res = candidate[i];
+                if constexpr (!three_way) {
+                    if (res != nullptr && comparator(keys[first + i], get_value(res))) {
+                        res = nullptr;
+                    }
+                }
+                store(first + i, res == nullptr ? end()
+                    : static_cast<set_element<Tag>*>(res));
+            }
+        }
+    }
+
+    // O(h) nothrow, read-only
+    template <typename K>
+    set_element<Tag>* upper_bound(K const& value) const {
+        compare_ref comparator = key_compare();
+        set_element_base* res = root;
+        set_element_base* tr = root->left;
+        while (tr != nullptr) {
+            if (less(comparator, value, get_value(tr))) {
+                res = tr;
+                tr = tr->left;
+            }
+            else {
+                tr = tr->right;
+            }
+        }
+        return static_cast<set_element<Tag>*>(res);
+    }
+
+    static constexpr std::size_t walk_depth = 64;
+
+    // O(n) nothrow if visit is, read-only. Calls visit(U*) for every
+    // element in order. An explicit stack replaces the climbs of get_next,
+    // and the right subtree of an element is prefetched before it is
+    // visited; a tree deeper than walk_depth is finished through the
+    // parent links.
+    template <typename Visit>
+    void for_each(Visit visit) const {
+        set_element_base* stack[walk_depth];
+        std::size_t top = 0;
+        for (auto tr = root->left; tr != nullptr; tr = tr->left) {
+            if (top == walk_depth) {
+                return walk_links(get_min(tr), root, visit);
+            }
+            stack[top++] = tr;
+        }
+        walk(stack, top, root, visit);
+    }
+
+    // O(h + k) nothrow if visit is, read-only. The same for the elements
+    // from lower_bound(value) up to last, which must not precede them.
+    template <typename K, typename Visit>
+    void for_each(K const& value, set_element_base* last, Visit visit) const {
+        compare_ref comparator = key_compare();
+        set_element_base* stack[walk_depth];
+        std::size_t top = 0;
+        for (auto tr = root->left; tr != nullptr;) {
+            if (less(comparator, get_value(tr), value)) {
+                tr = tr->right;
+                continue;
+            }
+            if (top == walk_depth) {
+                return walk_links(lower_bound(value), last, visit);
+            }
+            stack[top++] = tr;
+            tr = tr->left;
+        }
+        walk(stack, top, last, visit);
+    }
+
+#ifdef BIMAP_STATS
+    // O(n) nothrow, read-only. Walks the tree through the parent links, so
+    // it needs no stack.
+    index_stats stats() const {
+        index_stats res = counters;
+        std::size_t nodes = 0;
+        std::size_t total = 0;
+        std::size_t depth = 1;
+        set_element_base* from = root;
+        set_element_base* tr = root->left;
+        while (tr != nullptr && tr != root) {
+            set_element_base* next;
+            if (from == tr->parent) {
+                nodes++;
+                total += depth;
+                res.max_depth = std::max(res.max_depth, depth);
+                next = tr->left != nullptr ? tr->left
+                    : tr->right != nullptr ? tr->right : tr->parent;
+            }
+            else if (from == tr->left && tr->right != nullptr) {
+                next = tr->right;
+            }
+            else {
+                next = tr->parent;
+            }
+            if (next == tr->parent) {
+                depth--;
+            }
+            else {
+                depth++;
+            }
+            from = tr;
+            tr = next;
+        }
+        res.average_depth = nodes == 0 ? 0 : double(total) / double(nodes);
+        return res;
+    }
+#endif
+
+private:
+    static U* to_node(set_element_base* tr) {
+        return static_cast<U*>(static_cast<set_element<Tag>*>(tr));
+    }
+
+    // stack holds the elements whose turn comes next, deepest on top
+    template <typename Visit>
+    void walk(set_element_base** stack, std::size_t top,
+        set_element_base* last, Visit& visit) const {
+        while (top != 0) {
+            auto tr = stack[--top];
+            if (tr == last) {
+                return;
+            }
+            auto next = tr->right;
+            if (next != nullptr) {
+                prefetch(next);
+            }
+            visit(to_node(tr));
+            for (; next != nullptr; next = next->left) {
+                if (top == walk_depth) {
+                    return walk_links(get_min(next), last, visit);
+                }
+                stack[top++] = next;
+            }
+        }
+    }
+
+    template <typename Visit>
+    static void walk_links(set_element_base* tr, set_element_base* last,
+        Visit& visit) {
+        for (; tr != last; tr = get_next(tr)) {
+            visit(to_node(tr));
+        }
+    }
+
+public:
     void swap(set& other) {
+        std::swap(static_cast<Compare&>(*this), static_cast<Compare&>(other));
         auto ptr = root->left;
         set_left(root, other.root->left);
         set_left(other.root, ptr);
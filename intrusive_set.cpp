@@ -5,8 +5,5 @@
 #include "intrusive-set.h"
 
 namespace intrusive {
-    std::default_random_engine set_element_base::engine =
-        std::default_random_engine();
-    std::uniform_int_distribution<uint32_t> set_element_base::random_elem =
-        std::uniform_int_distribution<uint32_t>(52);
+    thread_local priority_generator set_priority::engine;
 }
\ No newline at end of file
@@ -0,0 +1,619 @@
+#pragma once
+
+#include "frozen-bimap.h"
+#include <cerrno>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <cstring> // std::memcmp, std::memcpy
+#include <functional> // std::less, std::invoke_result_t
+#include <iterator>
+#include <limits>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility> // std::exchange
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
+#endif
+
+namespace mapped {
+
+using index_t = frozen::index_t;
+
+// How a key is laid out in the image. A trivially copyable key is stored
+// as is and read in place; a string is stored as a reference into the
+// string area and read as a string_view.
+template <typename Key>
+struct codec {
+    static_assert(std::is_trivially_copyable_v<Key>,
+        "mapped: keys must be trivially copyable or std::string");
+
+    using slot = Key;
+    using view = Key const&;
+
+    // Compare applied to views
+    template <typename Compare>
+    using compare = Compare;
+
+    static std::size_t extra(Key const&) {
+        return 0;
+    }
+
+    static slot encode(Key const& key, std::uint64_t&) {
+        return key;
+    }
+
+    static void write_extra(Key const&, std::ostream&) {}
+
+    static bool valid(slot const&, std::uint64_t) {
+        return true;
+    }
+
+    static view decode(slot const& s, char const*) {
+        return s;
+    }
+};
+
+struct string_ref {
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+
+template <>
+struct codec<std::string> {
+    using slot = string_ref;
+    using view = std::string_view;
+
+    // the bytes are compared as the strings themselves would be
+    template <typename Compare>
+    using compare = std::enable_if_t<
+        std::is_same_v<Compare, std::less<std::string>> ||
+        std::is_same_v<Compare, std::less<>>, std::less<>>;
+
+    static std::size_t extra(std::string const& key) {
+        return key.size();
+    }
+
+    static slot encode(std::string const& key, std::uint64_t& strings_pos) {
+        slot res{ strings_pos, key.size() };
+        strings_pos += key.size();
+        return res;
+    }
+
+    static void write_extra(std::string const& key, std::ostream& out) {
+        out.write(key.data(), static_cast<std::streamsize>(key.size()));
+    }
+
+    // the referenced bytes lie inside a string area of strings_size bytes
+    static bool valid(slot const& s, std::uint64_t strings_size) {
+        return s.offset <= strings_size && s.size <= strings_size - s.offset;
+    }
+
+    static view decode(slot const& s, char const* strings) {
+        return { strings + s.offset, static_cast<std::size_t>(s.size) };
+    }
+};
+
+// Image layout: the header, then at 64-byte aligned offsets the left keys
+// in left order, the right keys of the same pairs, right_order and
+// right_rank as in frozen_bimap (n + 1 entries each) and the string area.
+// Every offset is from the start of the image.
+struct header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t left_slot_size;
+    std::uint32_t left_slot_align;
+    std::uint32_t right_slot_size;
+    std::uint32_t right_slot_align;
+    std::uint64_t count;
+    std::uint64_t left_offset;
+    std::uint64_t right_offset;
+    std::uint64_t order_offset;
+    std::uint64_t rank_offset;
+    std::uint64_t strings_offset;
+    std::uint64_t strings_size;
+    std::uint64_t total_size;
+};
+
+inline constexpr char magic[8] = { 'B', 'I', 'M', 'A', 'P', 'I', 'M', 'G' };
+inline constexpr std::uint32_t version = 1;
+inline constexpr std::uint32_t byte_order = 0x01020304;
+inline constexpr std::size_t section_align = 64;
+
+inline std::uint64_t align_up(std::uint64_t pos) {
+    return (pos + section_align - 1) / section_align * section_align;
+}
+
+inline void pad(std::ostream& out, std::uint64_t& pos, std::uint64_t to) {
+    static constexpr char zeros[section_align] = {};
+    out.write(zeros, static_cast<std::streamsize>(to - pos));
+    pos = to;
+}
+
+template <typename T>
+void put(std::ostream& out, std::uint64_t& pos, T const& value) {
+    out.write(reinterpret_cast<char const*>(&value), sizeof(T));
+    pos += sizeof(T);
+}
+
+template <typename Compare, typename A, typename B>
+bool less(Compare const& comparator, A const& a, B const& b) {
+    if constexpr (std::is_convertible_v<
+        std::invoke_result_t<Compare const&, A const&, B const&>,
+        std::partial_ordering>) {
+        return comparator(a, b) < 0;
+    }
+    else {
+        return comparator(a, b);
+    }
+}
+
+// First i in [0, n) for which go_right(i) is false, n if there is none.
+template <typename GoRight>
+index_t partition_point(std::size_t n, GoRight go_right) {
+    std::size_t first = 0;
+    while (n > 0) {
+        auto half = n / 2;
+        if (go_right(first + half)) {
+            first += half + 1;
+            n -= half + 1;
+        }
+        else {
+            n = half;
+        }
+    }
+    return static_cast<index_t>(first);
+}
+
+} // namespace mapped
+
+// Записывает frozen_bimap в образ, который mapped_bimap читает на месте
+// (например, из mmap). Образ версионирован и хранит пары и оба порядка
+// как смещения, но не компараторы: читать его нужно с теми же типами и
+// компараторами. При ошибке записи бросает std::ios_base::failure.
+template <typename Left, typename Right, typename CompareLeft,
+    typename CompareRight>
+void write_image(frozen_bimap<Left, Right, CompareLeft, CompareRight> const& map,
+    std::ostream& out) {
+    using left_codec = mapped::codec<Left>;
+    using right_codec = mapped::codec<Right>;
+    using left_slot = typename left_codec::slot;
+    using right_slot = typename right_codec::slot;
+    using mapped::index_t;
+
+    std::uint64_t n = map.size();
+    std::uint64_t strings_size = 0;
+    for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+        strings_size += left_codec::extra(*it) + right_codec::extra(*it.flip());
+    }
+
+    mapped::header h{};
+    std::memcpy(h.magic, mapped::magic, sizeof(h.magic));
+    h.version = mapped::version;
+    h.byte_order = mapped::byte_order;
+    h.left_slot_size = sizeof(left_slot);
+    h.left_slot_align = alignof(left_slot);
+    h.right_slot_size = sizeof(right_slot);
+    h.right_slot_align = alignof(right_slot);
+    h.count = n;
+    h.left_offset = mapped::align_up(sizeof(mapped::header));
+    h.right_offset = mapped::align_up(h.left_offset + n * sizeof(left_slot));
+    h.order_offset = mapped::align_up(h.right_offset + n * sizeof(right_slot));
+    h.rank_offset = mapped::align_up(h.order_offset + (n + 1) * sizeof(index_t));
+    h.strings_offset = mapped::align_up(h.rank_offset + (n + 1) * sizeof(index_t));
+    h.strings_size = strings_size;
+    h.total_size = h.strings_offset + strings_size;
+
+    auto old_mask = out.exceptions();
+    out.exceptions(std::ios_base::badbit | std::ios_base::failbit);
+    try {
+        std::uint64_t pos = 0;
+        std::uint64_t strings_pos = 0;
+        mapped::put(out, pos, h);
+        mapped::pad(out, pos, h.left_offset);
+        for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+            mapped::put(out, pos, left_codec::encode(*it, strings_pos));
+        }
+        mapped::pad(out, pos, h.right_offset);
+        for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+            mapped::put(out, pos, right_codec::encode(*it.flip(), strings_pos));
+        }
+        mapped::pad(out, pos, h.order_offset);
+        for (auto it = map.begin_right(); it != map.end_right(); ++it) {
+            mapped::put(out, pos, static_cast<index_t>(it.flip() - map.begin_left()));
+        }
+        mapped::put(out, pos, static_cast<index_t>(n));
+        mapped::pad(out, pos, h.rank_offset);
+        for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+            mapped::put(out, pos, static_cast<index_t>(it.flip() - map.begin_right()));
+        }
+        mapped::put(out, pos, static_cast<index_t>(n));
+        mapped::pad(out, pos, h.strings_offset);
+        for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+            left_codec::write_extra(*it, out);
+        }
+        for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+            right_codec::write_extra(*it.flip(), out);
+        }
+        out.flush();
+    }
+    catch (...) {
+        out.exceptions(old_mask);
+        throw;
+    }
+    out.exceptions(old_mask);
+}
+
+// Только читающее представление образа из write_image поверх чужой памяти.
+// Ничего не разбирает и не аллоцирует: при создании проверяется только
+// заголовок, поиск идет бинарным поиском прямо по образу. Строковые ключи
+// отдаются как std::string_view. Память должна жить дольше представления;
+// образ, отображенный через mapped_file, делят все процессы на машине.
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+    typename CompareRight = std::less<Right>>
+struct mapped_bimap {
+private:
+    using left_codec = mapped::codec<Left>;
+    using right_codec = mapped::codec<Right>;
+    using left_slot = typename left_codec::slot;
+    using right_slot = typename right_codec::slot;
+    using left_compare = typename left_codec::template compare<CompareLeft>;
+    using right_compare = typename right_codec::template compare<CompareRight>;
+    using index_t = mapped::index_t;
+
+public:
+    using left_view = typename left_codec::view;
+    using right_view = typename right_codec::view;
+
+private:
+    template <bool IsLeft>
+    struct mapped_iterator {
+        using value_type = std::remove_cvref_t<
+            std::conditional_t<IsLeft, left_view, right_view>> const;
+        using iterator_category = std::random_access_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = std::conditional_t<IsLeft, left_view, right_view>;
+
+        mapped_iterator() = default;
+
+        reference operator*() const {
+            if constexpr (IsLeft) {
+                return map->left_at(pos);
+            }
+            else {
+                return map->right_at(map->right_order[pos]);
+            }
+        }
+
+        reference operator[](difference_type n) const {
+            return *(*this + n);
+        }
+
+        mapped_iterator& operator+=(difference_type n) {
+            pos = static_cast<index_t>(pos + n);
+            return *this;
+        }
+
+        mapped_iterator& operator-=(difference_type n) {
+            return *this += -n;
+        }
+
+        mapped_iterator& operator++() {
+            return *this += 1;
+        }
+
+        mapped_iterator operator++(int) {
+            mapped_iterator old = *this;
+            ++(*this);
+            return old;
+        }
+
+        mapped_iterator& operator--() {
+            return *this -= 1;
+        }
+
+        mapped_iterator operator--(int) {
+            mapped_iterator old = *this;
+            --(*this);
+            return old;
+        }
+
+        friend mapped_iterator operator+(mapped_iterator it, difference_type n) {
+            return it += n;
+        }
+
+        friend mapped_iterator operator+(difference_type n, mapped_iterator it) {
+            return it += n;
+        }
+
+        friend mapped_iterator operator-(mapped_iterator it, difference_type n) {
+            return it -= n;
+        }
+
+        friend difference_type operator-(mapped_iterator const& a,
+            mapped_iterator const& b) {
+            return static_cast<difference_type>(a.pos) -
+                static_cast<difference_type>(b.pos);
+        }
+
+        // end() одной стороны переходит в end() другой
+        mapped_iterator<!IsLeft> flip() const {
+            if constexpr (IsLeft) {
+                return mapped_iterator<false>(map, map->right_rank[pos]);
+            }
+            else {
+                return mapped_iterator<true>(map, map->right_order[pos]);
+            }
+        }
+
+        bool operator==(mapped_iterator const& other) const {
+            return pos == other.pos;
+        }
+
+        auto operator<=>(mapped_iterator const& other) const {
+            return pos <=> other.pos;
+        }
+
+    private:
+        friend struct mapped_bimap;
+
+        mapped_iterator(mapped_bimap const* map, index_t pos) : map(map), pos(pos) {}
+
+        mapped_bimap const* map{ nullptr };
+        index_t pos{ 0 };
+    };
+
+public:
+    using left_iterator = mapped_iterator<true>;
+    using right_iterator = mapped_iterator<false>;
+
+    // O(1): проверяет заголовок и границы разделов. Если это не образ
+    // write_image для этих типов или он обрезан -- бросает
+    // std::invalid_argument. image должен быть выровнен на 64 байта (а
+    // mmap выравнивает на страницу). Содержимое разделов не читается:
+    // образ из недоверенного источника сначала проверяется validate().
+    explicit mapped_bimap(std::span<std::byte const> image,
+        left_compare left_cmp = left_compare(),
+        right_compare right_cmp = right_compare())
+        : left_cmp(left_cmp), right_cmp(right_cmp) {
+        mapped::header h;
+        if (image.size() < sizeof(h)) {
+            bad_image();
+        }
+        std::memcpy(&h, image.data(), sizeof(h));
+        if (std::memcmp(h.magic, mapped::magic, sizeof(h.magic)) != 0 ||
+            h.version != mapped::version || h.byte_order != mapped::byte_order ||
+            h.left_slot_size != sizeof(left_slot) ||
+            h.left_slot_align != alignof(left_slot) ||
+            h.right_slot_size != sizeof(right_slot) ||
+            h.right_slot_align != alignof(right_slot) ||
+            h.count >= std::numeric_limits<index_t>::max() ||
+            h.total_size > image.size() ||
+            reinterpret_cast<std::uintptr_t>(image.data()) % mapped::section_align != 0) {
+            bad_image();
+        }
+        auto n = h.count;
+        check_section(h, h.left_offset, n * sizeof(left_slot));
+        check_section(h, h.right_offset, n * sizeof(right_slot));
+        check_section(h, h.order_offset, (n + 1) * sizeof(index_t));
+        check_section(h, h.rank_offset, (n + 1) * sizeof(index_t));
+        if (h.strings_offset > h.total_size ||
+            h.strings_size > h.total_size - h.strings_offset) {
+            bad_image();
+        }
+        auto base = reinterpret_cast<char const*>(image.data());
+        count = static_cast<index_t>(n);
+        left_keys = reinterpret_cast<left_slot const*>(base + h.left_offset);
+        right_keys = reinterpret_cast<right_slot const*>(base + h.right_offset);
+        right_order = reinterpret_cast<index_t const*>(base + h.order_offset);
+        right_rank = reinterpret_cast<index_t const*>(base + h.rank_offset);
+        strings = base + h.strings_offset;
+        strings_size = h.strings_size;
+    }
+
+    // O(n): проверяет содержимое разделов -- right_order и right_rank
+    // взаимно обратные перестановки, строки лежат внутри своего раздела.
+    // Если нет -- бросает std::invalid_argument. После успешной проверки
+    // никакой поиск не выходит за границы образа; порядок ключей не
+    // проверяется, на неупорядоченном образе поиск просто ошибается.
+    void validate() const {
+        if (right_order[count] != count || right_rank[count] != count) {
+            bad_image();
+        }
+        for (std::size_t i = 0; i < count; i++) {
+            auto pos = right_order[i];
+            if (pos >= count || right_rank[pos] != i ||
+                !left_codec::valid(left_keys[i], strings_size) ||
+                !right_codec::valid(right_keys[i], strings_size)) {
+                bad_image();
+            }
+        }
+    }
+
+    // Возвращает итератор по элементу. Если не найден - соответствующий end()
+    left_iterator find_left(left_view left) const {
+        auto it = lower_bound_left(left);
+        return it != end_left() && !mapped::less(left_cmp, left, *it) ? it : end_left();
+    }
+
+    right_iterator find_right(right_view right) const {
+        auto it = lower_bound_right(right);
+        return it != end_right() && !mapped::less(right_cmp, right, *it) ? it : end_right();
+    }
+
+    // Возвращает противоположный элемент по элементу
+    // Если элемента не существует -- бросает std::out_of_range
+    right_view at_left(left_view key) const {
+        return at(find_left(key), end_left());
+    }
+
+    left_view at_right(right_view key) const {
+        return at(find_right(key), end_right());
+    }
+
+    // lower и upper bound'ы по каждой стороне
+    left_iterator lower_bound_left(left_view left) const {
+        return left_iterator(this, mapped::partition_point(count,
+            [&](std::size_t i) { return mapped::less(left_cmp, left_at(i), left); }));
+    }
+
+    left_iterator upper_bound_left(left_view left) const {
+        return left_iterator(this, mapped::partition_point(count,
+            [&](std::size_t i) { return !mapped::less(left_cmp, left, left_at(i)); }));
+    }
+
+    right_iterator lower_bound_right(right_view right) const {
+        return right_iterator(this, mapped::partition_point(count,
+            [&](std::size_t i) {
+                return mapped::less(right_cmp, right_at(right_order[i]), right);
+            }));
+    }
+
+    right_iterator upper_bound_right(right_view right) const {
+        return right_iterator(this, mapped::partition_point(count,
+            [&](std::size_t i) {
+                return !mapped::less(right_cmp, right, right_at(right_order[i]));
+            }));
+    }
+
+    left_iterator begin_left() const {
+        return left_iterator(this, 0);
+    }
+
+    left_iterator end_left() const {
+        return left_iterator(this, count);
+    }
+
+    right_iterator begin_right() const {
+        return right_iterator(this, 0);
+    }
+
+    right_iterator end_right() const {
+        return right_iterator(this, count);
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    std::size_t size() const {
+        return count;
+    }
+
+private:
+    [[noreturn]] static void bad_image() {
+        throw std::invalid_argument("mapped_bimap: bad image");
+    }
+
+    static void check_section(mapped::header const& h, std::uint64_t offset,
+        std::uint64_t size) {
+        if (offset % mapped::section_align != 0 || offset > h.total_size ||
+            size > h.total_size - offset) {
+            bad_image();
+        }
+    }
+
+    left_view left_at(std::size_t i) const {
+        return left_codec::decode(left_keys[i], strings);
+    }
+
+    right_view right_at(std::size_t i) const {
+        return right_codec::decode(right_keys[i], strings);
+    }
+
+    template <typename Iterator>
+    static decltype(auto) at(Iterator it, Iterator end) {
+        if (it == end) {
+            throw std::out_of_range("");
+        }
+        return *it.flip();
+    }
+
+    [[no_unique_address]] left_compare left_cmp;
+    [[no_unique_address]] right_compare right_cmp;
+    index_t count{ 0 };
+    left_slot const* left_keys{ nullptr };
+    right_slot const* right_keys{ nullptr };
+    index_t const* right_order{ nullptr };
+    index_t const* right_rank{ nullptr };
+    char const* strings{ nullptr };
+    std::uint64_t strings_size{ 0 };
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+// Файл, отображенный в память только для чтения. Отображение разделяемое,
+// так что процессы, открывшие один образ, делят страницы page cache. При
+// ошибке бросает std::system_error.
+struct mapped_file {
+    mapped_file() = default;
+
+    explicit mapped_file(char const* path) {
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), path);
+        }
+        length = static_cast<std::size_t>(st.st_size);
+        if (length != 0) {
+            void* ptr = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            if (ptr == MAP_FAILED) {
+                int error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::generic_category(), path);
+            }
+            data = static_cast<std::byte const*>(ptr);
+        }
+        ::close(fd);
+    }
+
+    mapped_file(mapped_file const&) = delete;
+    mapped_file& operator=(mapped_file const&) = delete;
+
+    mapped_file(mapped_file&& other) noexcept
+        : data(std::exchange(other.data, nullptr)),
+        length(std::exchange(other.length, 0)) {}
+
+    mapped_file& operator=(mapped_file&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            data = std::exchange(other.data, nullptr);
+            length = std::exchange(other.length, 0);
+        }
+        return *this;
+    }
+
+    ~mapped_file() {
+        unmap();
+    }
+
+    std::span<std::byte const> bytes() const {
+        return { data, length };
+    }
+
+private:
+    void unmap() noexcept {
+        if (data != nullptr) {
+            ::munmap(const_cast<std::byte*>(data), length);
+        }
+    }
+
+    std::byte const* data{ nullptr };
+    std::size_t length{ 0 };
+};
+#endif
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm> // std::sort, std::inplace_merge, std::min, std::max
+#include <cstddef>
+#include <exception> // std::exception_ptr
+#include <thread>
+#include <vector>
+
+namespace parallel {
+
+// How many threads a bulk build or copy of a bimap may use, 0 for one per
+// core. Small jobs run on the calling thread regardless.
+struct policy {
+    unsigned threads{ 0 };
+};
+
+// Elements below which a chunk is not worth a thread of its own.
+inline constexpr std::size_t min_chunk = std::size_t(1) << 14;
+
+// Number of chunks to split n elements into, at least 1.
+inline std::size_t chunks_for(policy p, std::size_t n) {
+    std::size_t threads = p.threads != 0 ? p.threads
+        : std::max(1u, std::thread::hardware_concurrency());
+    return std::max<std::size_t>(1, std::min(threads, n / min_chunk));
+}
+
+// Start of chunk i when [0, n) is split into k nearly equal chunks;
+// chunk_begin(n, k, k) == n.
+inline std::size_t chunk_begin(std::size_t n, std::size_t k, std::size_t i) {
+    return n / k * i + std::min(i, n % k);
+}
+
+// Runs f(i) for every i in [0, k): the last one on the calling thread,
+// the others on threads of their own, or here as well if a thread cannot
+// be started. Waits for all of them and rethrows the first exception.
+template <typename F>
+void run(std::size_t k, F f) {
+    if (k == 1) {
+        f(std::size_t(0));
+        return;
+    }
+    std::vector<std::exception_ptr> errors(k);
+    std::vector<std::thread> threads;
+    threads.reserve(k - 1);
+    auto task = [&](std::size_t i) {
+        try {
+            f(i);
+        }
+        catch (...) {
+            errors[i] = std::current_exception();
+        }
+    };
+    try {
+        for (std::size_t i = 0; i + 1 < k; i++) {
+            threads.emplace_back(task, i);
+        }
+    }
+    catch (...) {
+        for (std::size_t i = threads.size(); i + 1 < k; i++) {
+            task(i);
+        }
+    }
+    task(k - 1);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+// O(n log n / k + n log k): sorts k chunks on separate threads, then
+// merges neighbouring runs pairwise, twice as long every round.
+template <typename RandomIt, typename Less>
+void sort(RandomIt first, RandomIt last, Less less, std::size_t k) {
+    auto n = static_cast<std::size_t>(last - first);
+    std::vector<std::size_t> bounds(k + 1);
+    for (std::size_t i = 0; i <= k; i++) {
+        bounds[i] = chunk_begin(n, k, i);
+    }
+    run(k, [&](std::size_t i) {
+        std::sort(first + bounds[i], first + bounds[i + 1], less);
+    });
+    for (std::size_t width = 1; width < k; width *= 2) {
+        run((k + 2 * width - 1) / (2 * width), [&](std::size_t p) {
+            auto lo = 2 * width * p;
+            auto mid = std::min(lo + width, k);
+            auto hi = std::min(lo + 2 * width, k);
+            if (mid < hi) {
+                std::inplace_merge(first + bounds[lo], first + bounds[mid],
+                    first + bounds[hi], less);
+            }
+        });
+    }
+}
+
+} // namespace parallel
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstddef>
+#include <memory> // std::shared_ptr
+#include <new>
+#include <type_traits>
+
+// Fixed-size block pool: blocks are carved out of geometrically growing
+// slabs and recycled through an intrusive free list. The block size is
+// fixed by the first allocation; anything that does not fit goes to the
+// global operator new. Not thread-safe, like the containers using it.
+struct node_pool {
+    node_pool() = default;
+    node_pool(node_pool const&) = delete;
+    node_pool& operator=(node_pool const&) = delete;
+
+    ~node_pool() {
+        release();
+    }
+
+    void* allocate(std::size_t size, std::size_t align) {
+        if (block_size == 0) {
+            block_align =
+                align < alignof(free_block) ? alignof(free_block) : align;
+            block_size = round_up(
+                size < sizeof(free_block) ? sizeof(free_block) : size, block_align);
+        }
+        if (!pooled(size, align)) {
+            return ::operator new(size, std::align_val_t(align));
+        }
+        if (free_list != nullptr) {
+            auto res = free_list;
+            free_list = free_list->next;
+            return res;
+        }
+        if (bump == bump_end) {
+            grow();
+        }
+        auto res = bump;
+        bump += block_size;
+        return res;
+    }
+
+    void deallocate(void* ptr, std::size_t size, std::size_t align) noexcept {
+        if (!pooled(size, align)) {
+            ::operator delete(ptr, std::align_val_t(align));
+            return;
+        }
+        free_list = ::new (ptr) free_block{ free_list };
+    }
+
+    // Frees every slab at once. Blocks handed out before become invalid,
+    // their objects must not need destruction.
+    void release() noexcept {
+        while (slabs != nullptr) {
+            auto next = slabs->next;
+            ::operator delete(slabs, std::align_val_t(alignof(slab)));
+            slabs = next;
+        }
+        free_list = nullptr;
+        bump = bump_end = nullptr;
+        next_blocks = first_blocks;
+    }
+
+private:
+    struct free_block {
+        free_block* next;
+    };
+
+    struct alignas(std::max_align_t) slab {
+        slab* next;
+    };
+
+    static constexpr std::size_t first_blocks = 32;
+    static constexpr std::size_t max_blocks = 4096;
+
+    static std::size_t round_up(std::size_t size, std::size_t align) {
+        return (size + align - 1) / align * align;
+    }
+
+    bool pooled(std::size_t size, std::size_t align) const {
+        return size <= block_size && align <= block_align &&
+            block_align <= alignof(slab);
+    }
+
+    void grow() {
+        auto header = round_up(sizeof(slab), block_align);
+        void* mem = ::operator new(header + next_blocks * block_size,
+            std::align_val_t(alignof(slab)));
+        slabs = ::new (mem) slab{ slabs };
+        bump = static_cast<std::byte*>(mem) + header;
+        bump_end = bump + next_blocks * block_size;
+        if (next_blocks < max_blocks) {
+            next_blocks *= 2;
+        }
+    }
+
+    std::size_t block_size{ 0 };
+    std::size_t block_align{ 0 };
+    free_block* free_list{ nullptr };
+    std::byte* bump{ nullptr };
+    std::byte* bump_end{ nullptr };
+    slab* slabs{ nullptr };
+    std::size_t next_blocks{ first_blocks };
+};
+
+// Allocator over a node_pool shared by all its copies and rebinds, so
+// nodes may move between containers built from the same allocator. A copy
+// of a container starts its own pool.
+//
+// For build-once tables a monotonic arena can be plugged in the same way
+// through std::pmr::polymorphic_allocator over a
+// std::pmr::monotonic_buffer_resource.
+template <typename T>
+struct pool_allocator {
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    // Arrays, such as the buckets of a hashed side, are not nodes: they go
+    // to the global heap and hold no reference to the pool.
+    template <typename U>
+    using array_allocator = std::allocator<U>;
+
+    pool_allocator() : pool(std::make_shared<node_pool>()) {}
+
+    template <typename U>
+    pool_allocator(pool_allocator<U> const& other) noexcept : pool(other.pool) {}
+
+    T* allocate(std::size_t n) {
+        if (n != 1) {
+            return static_cast<T*>(
+                ::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+        }
+        return static_cast<T*>(pool->allocate(sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t n) noexcept {
+        if (n != 1) {
+            ::operator delete(ptr, std::align_val_t(alignof(T)));
+            return;
+        }
+        pool->deallocate(ptr, sizeof(T), alignof(T));
+    }
+
+    // Frees the whole pool at once if no other allocator shares it. Every
+    // block handed out becomes invalid, objects in them are not destroyed.
+    bool try_release() noexcept {
+        if (pool.use_count() != 1) {
+            return false;
+        }
+        pool->release();
+        return true;
+    }
+
+    pool_allocator select_on_container_copy_construction() const {
+        return pool_allocator();
+    }
+
+    template <typename U>
+    friend bool operator==(pool_allocator const& a, pool_allocator<U> const& b) {
+        return a.same_pool(b);
+    }
+
+    template <typename U>
+    friend bool operator!=(pool_allocator const& a, pool_allocator<U> const& b) {
+        return !a.same_pool(b);
+    }
+
+private:
+    template <typename U>
+    friend struct pool_allocator;
+
+    template <typename U>
+    bool same_pool(pool_allocator<U> const& other) const {
+        return pool == other.pool;
+    }
+
+    std::shared_ptr<node_pool> pool;
+};
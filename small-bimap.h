@@ -0,0 +1,583 @@
+#pragma once
+
+#include "bimap.h"
+#include "intrusive-set.h" // intrusive::is_three_way
+#include <algorithm>       // std::copy, std::find, std::partition_point
+#include <cstddef>
+#include <cstdint>
+#include <functional> // std::less
+#include <iterator>
+#include <memory> // std::allocator, std::destroy_at
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility> // std::pair, std::move
+
+// bimap, который хранит до N пар прямо в себе, без узлов в куче, и
+// переходит к обычному bimap, когда пар становится больше. Обратно --
+// только через clear(). Обе стороны упорядочены обычными компараторами.
+//
+// Пары лежат в N ячейках без порядка, by_left и by_right -- номера ячеек в
+// порядке каждой стороны. Позиция ключа -- число меньших ключей: для
+// чисел и указателей оно считается проходом по всем ячейкам без ветвлений,
+// который векторизуется компилятором, для остальных -- двоичным поиском.
+template <typename Left, typename Right, std::size_t N = 16,
+    typename CompareLeft = std::less<Left>,
+    typename CompareRight = std::less<Right>,
+    typename Allocator = std::allocator<std::pair<Left, Right>>>
+struct small_bimap {
+    using left_t = Left;
+    using right_t = Right;
+    using allocator_type = Allocator;
+    using large_type = bimap<Left, Right, CompareLeft, CompareRight, Allocator>;
+
+    static_assert(N > 0 && N <= 255, "small_bimap: N must fit in a byte");
+    static_assert(std::is_nothrow_move_constructible_v<Left> &&
+        std::is_nothrow_move_constructible_v<Right>,
+        "small_bimap: erase moves the last pair into the freed slot");
+
+private:
+    template <bool IsLeft>
+    struct small_iterator {
+        using value_type = std::conditional_t<IsLeft, Left, Right> const;
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using pointer = value_type*;
+        using reference = value_type&;
+
+        small_iterator() = default;
+
+        reference operator*() const {
+            if (map->large) {
+                return *it;
+            }
+            if constexpr (IsLeft) {
+                return map->small.items[map->small.by_left[pos]].value.first;
+            }
+            else {
+                return map->small.items[map->small.by_right[pos]].value.second;
+            }
+        }
+
+        pointer operator->() const {
+            return &**this;
+        }
+
+        small_iterator& operator++() {
+            if (map->large) {
+                ++it;
+            }
+            else {
+                pos++;
+            }
+            return *this;
+        }
+
+        small_iterator operator++(int) {
+            small_iterator old = *this;
+            ++(*this);
+            return old;
+        }
+
+        small_iterator& operator--() {
+            if (map->large) {
+                --it;
+            }
+            else {
+                pos--;
+            }
+            return *this;
+        }
+
+        small_iterator operator--(int) {
+            small_iterator old = *this;
+            --(*this);
+            return old;
+        }
+
+        // end() одной стороны переходит в end() другой
+        small_iterator<!IsLeft> flip() const {
+            if (map->large) {
+                return small_iterator<!IsLeft>(map, 0, it.flip());
+            }
+            auto const& s = map->small;
+            if (pos == s.count) {
+                return small_iterator<!IsLeft>(map, pos);
+            }
+            if constexpr (IsLeft) {
+                return small_iterator<false>(map, s.rank(s.by_right, s.by_left[pos]));
+            }
+            else {
+                return small_iterator<true>(map, s.rank(s.by_left, s.by_right[pos]));
+            }
+        }
+
+        bool operator==(small_iterator const& other) const {
+            if (map != nullptr && map->large) {
+                return it == other.it;
+            }
+            return pos == other.pos;
+        }
+
+        bool operator!=(small_iterator const& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend struct small_bimap;
+        friend struct small_iterator<!IsLeft>;
+
+        using large_iterator = std::conditional_t<IsLeft,
+            decltype(std::declval<large_type const&>().begin_left()),
+            decltype(std::declval<large_type const&>().begin_right())>;
+
+        small_iterator(small_bimap const* map, std::size_t pos,
+            large_iterator it = large_iterator())
+            : map(map), pos(pos), it(it) {}
+
+        small_bimap const* map{ nullptr };
+        std::size_t pos{ 0 };
+        large_iterator it;
+    };
+
+public:
+    using left_iterator = small_iterator<true>;
+    using right_iterator = small_iterator<false>;
+
+    // Создает small_bimap не содержащий ни одной пары.
+    small_bimap(CompareLeft left_cmp = CompareLeft(),
+        CompareRight right_cmp = CompareRight(),
+        Allocator const& allocator = Allocator())
+        : left_cmp(std::move(left_cmp)), right_cmp(std::move(right_cmp)),
+        alloc(allocator), small() {}
+
+    small_bimap(small_bimap const& other)
+        : left_cmp(other.left_cmp), right_cmp(other.right_cmp),
+        alloc(other.alloc), small() {
+        if (other.large) {
+            std::destroy_at(&small);
+            new (&big) large_type(other.big);
+            large = true;
+        }
+        else {
+            small.copy_from(other.small);
+        }
+    }
+
+    small_bimap(small_bimap&& other) noexcept
+        : left_cmp(other.left_cmp), right_cmp(other.right_cmp),
+        alloc(other.alloc), small() {
+        take(std::move(other));
+    }
+
+    small_bimap& operator=(small_bimap const& other) {
+        if (this != &other) {
+            small_bimap tmp(other);
+            *this = std::move(tmp);
+        }
+        return *this;
+    }
+
+    small_bimap& operator=(small_bimap&& other) noexcept {
+        if (this != &other) {
+            clear();
+            left_cmp = other.left_cmp;
+            right_cmp = other.right_cmp;
+            alloc = other.alloc;
+            take(std::move(other));
+        }
+        return *this;
+    }
+
+    ~small_bimap() {
+        destroy();
+    }
+
+    void swap(small_bimap& other) noexcept {
+        small_bimap tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    // Освобождает все и возвращается к хранению пар в себе
+    void clear() noexcept {
+        destroy();
+        new (&small) inline_part();
+    }
+
+    // Вставка пары (left, right), возвращает итератор на left.
+    // Если такой left или right уже присутствуют, вставка не производится
+    // и возвращается end_left(). Вставка в заполненный small_bimap
+    // один раз копирует все N пар в bimap.
+    left_iterator insert(Left left, Right right) {
+        if (large) {
+            return left_iterator(this, 0, big.insert(std::move(left), std::move(right)));
+        }
+        auto l = lower_left(left);
+        if (equal_left(l, left)) {
+            return end_left();
+        }
+        auto r = lower_right(right);
+        if (equal_right(r, right)) {
+            return end_left();
+        }
+        if (small.count == N) {
+            promote();
+            return left_iterator(this, 0, big.insert(std::move(left), std::move(right)));
+        }
+        new (&small.items[small.count].value)
+            std::pair<Left, Right>(std::move(left), std::move(right));
+        small.link(l, r);
+        return left_iterator(this, l);
+    }
+
+    // Удаляет элемент и соответствующий ему парный, возвращает итератор
+    // на следующий за удаленным на той же стороне
+    left_iterator erase_left(left_iterator it) {
+        if (large) {
+            return left_iterator(this, 0, big.erase_left(it.it));
+        }
+        small.erase(it.pos, small.rank(small.by_right, small.by_left[it.pos]));
+        return it;
+    }
+
+    right_iterator erase_right(right_iterator it) {
+        if (large) {
+            return right_iterator(this, 0, big.erase_right(it.it));
+        }
+        small.erase(small.rank(small.by_left, small.by_right[it.pos]), it.pos);
+        return it;
+    }
+
+    bool erase_left(Left const& left) {
+        auto it = find_left(left);
+        if (it != end_left()) {
+            erase_left(it);
+            return true;
+        }
+        return false;
+    }
+
+    bool erase_right(Right const& right) {
+        auto it = find_right(right);
+        if (it != end_right()) {
+            erase_right(it);
+            return true;
+        }
+        return false;
+    }
+
+    // Возвращает итератор по элементу. Если не найден - соответствующий end()
+    left_iterator find_left(Left const& left) const {
+        if (large) {
+            return left_iterator(this, 0, big.find_left(left));
+        }
+        auto l = lower_left(left);
+        return equal_left(l, left) ? left_iterator(this, l) : end_left();
+    }
+
+    right_iterator find_right(Right const& right) const {
+        if (large) {
+            return right_iterator(this, 0, big.find_right(right));
+        }
+        auto r = lower_right(right);
+        return equal_right(r, right) ? right_iterator(this, r) : end_right();
+    }
+
+    // Возвращает противоположный элемент по элементу
+    // Если элемента не существует -- бросает std::out_of_range
+    Right const& at_left(Left const& key) const {
+        return at(find_left(key), end_left());
+    }
+
+    Left const& at_right(Right const& key) const {
+        return at(find_right(key), end_right());
+    }
+
+    // lower и upper bound'ы по каждой стороне
+    left_iterator lower_bound_left(Left const& left) const {
+        if (large) {
+            return left_iterator(this, 0, big.lower_bound_left(left));
+        }
+        return left_iterator(this, lower_left(left));
+    }
+
+    left_iterator upper_bound_left(Left const& left) const {
+        if (large) {
+            return left_iterator(this, 0, big.upper_bound_left(left));
+        }
+        return left_iterator(this, upper_left(left));
+    }
+
+    right_iterator lower_bound_right(Right const& right) const {
+        if (large) {
+            return right_iterator(this, 0, big.lower_bound_right(right));
+        }
+        return right_iterator(this, lower_right(right));
+    }
+
+    right_iterator upper_bound_right(Right const& right) const {
+        if (large) {
+            return right_iterator(this, 0, big.upper_bound_right(right));
+        }
+        return right_iterator(this, upper_right(right));
+    }
+
+    left_iterator begin_left() const {
+        return large ? left_iterator(this, 0, big.begin_left()) : left_iterator(this, 0);
+    }
+
+    left_iterator end_left() const {
+        return large ? left_iterator(this, 0, big.end_left())
+            : left_iterator(this, small.count);
+    }
+
+    right_iterator begin_right() const {
+        return large ? right_iterator(this, 0, big.begin_right())
+            : right_iterator(this, 0);
+    }
+
+    right_iterator end_right() const {
+        return large ? right_iterator(this, 0, big.end_right())
+            : right_iterator(this, small.count);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    std::size_t size() const {
+        return large ? big.size() : small.count;
+    }
+
+    // true, пока пары хранятся в самом small_bimap
+    bool is_small() const {
+        return !large;
+    }
+
+    allocator_type get_allocator() const {
+        return alloc;
+    }
+
+private:
+    using value_type = std::pair<Left, Right>;
+    using index_t = std::uint8_t;
+
+    union slot {
+        slot() {}
+        ~slot() {}
+
+        value_type value;
+    };
+
+    struct left_key {
+        Left const& operator()(value_type const& value) const {
+            return value.first;
+        }
+    };
+
+    struct right_key {
+        Right const& operator()(value_type const& value) const {
+            return value.second;
+        }
+    };
+
+    template <typename Compare, typename Key>
+    static bool less(Compare const& comparator, Key const& a, Key const& b) {
+        if constexpr (intrusive::is_three_way<Compare, Key>::value) {
+            return comparator(a, b) < 0;
+        }
+        else {
+            return comparator(a, b);
+        }
+    }
+
+    // count живых ячеек items[0, count), by_left и by_right -- их номера
+    // в порядке левых и правых ключей
+    struct inline_part {
+        slot items[N];
+        index_t by_left[N];
+        index_t by_right[N];
+        index_t count{ 0 };
+
+        inline_part() {}
+
+        inline_part(inline_part const&) = delete;
+        inline_part& operator=(inline_part const&) = delete;
+
+        ~inline_part() {
+            for (std::size_t i = 0; i < count; i++) {
+                std::destroy_at(&items[i].value);
+            }
+        }
+
+        // O(N) strong, *this пуст
+        void copy_from(inline_part const& other) {
+            for (; count < other.count; count++) {
+                new (&items[count].value) value_type(other.items[count].value);
+            }
+            std::copy(other.by_left, other.by_left + count, by_left);
+            std::copy(other.by_right, other.by_right + count, by_right);
+        }
+
+        // O(N) nothrow, *this пуст
+        void move_from(inline_part& other) noexcept {
+            for (; count < other.count; count++) {
+                new (&items[count].value) value_type(std::move(other.items[count].value));
+            }
+            std::copy(other.by_left, other.by_left + count, by_left);
+            std::copy(other.by_right, other.by_right + count, by_right);
+        }
+
+        // Число ключей меньше key: O(N) без ветвлений для чисел, иначе
+        // двоичный поиск по order
+        template <typename GetKey, typename Key, typename Compare>
+        std::size_t lower_bound(GetKey get, index_t const* order, Key const& key,
+            Compare const& comparator) const {
+            return bound(get, order, [&](Key const& x) {
+                return less(comparator, x, key);
+                });
+        }
+
+        template <typename GetKey, typename Key, typename Compare>
+        std::size_t upper_bound(GetKey get, index_t const* order, Key const& key,
+            Compare const& comparator) const {
+            return bound(get, order, [&](Key const& x) {
+                return !less(comparator, key, x);
+                });
+        }
+
+        // число ключей, для которых before истинно; они идут первыми в order
+        template <typename GetKey, typename Before>
+        std::size_t bound(GetKey get, index_t const* order, Before before) const {
+            using key_type = std::remove_cvref_t<
+                decltype(get(std::declval<value_type const&>()))>;
+            if constexpr (std::is_scalar_v<key_type>) {
+                std::size_t res = 0;
+                for (std::size_t i = 0; i < count; i++) {
+                    res += before(get(items[i].value));
+                }
+                return res;
+            }
+            else {
+                return static_cast<std::size_t>(
+                    std::partition_point(order, order + count, [&](index_t i) {
+                        return before(get(items[i].value));
+                    }) - order);
+            }
+        }
+
+        template <typename GetKey, typename Key, typename Compare>
+        bool equal(std::size_t pos, GetKey get, index_t const* order, Key const& key,
+            Compare const& comparator) const {
+            return pos < count && !less(comparator, key, get(items[order[pos]].value));
+        }
+
+        // O(N) nothrow, позиция ячейки i в order
+        std::size_t rank(index_t const* order, index_t i) const {
+            return static_cast<std::size_t>(std::find(order, order + count, i) - order);
+        }
+
+        // O(N) nothrow, ячейка count уже построена и встает на позиции l и r
+        void link(std::size_t l, std::size_t r) noexcept {
+            std::copy_backward(by_left + l, by_left + count, by_left + count + 1);
+            std::copy_backward(by_right + r, by_right + count, by_right + count + 1);
+            by_left[l] = count;
+            by_right[r] = count;
+            count++;
+        }
+
+        // O(N) nothrow, пара на позициях l и r; последняя ячейка
+        // переезжает на место освободившейся
+        void erase(std::size_t l, std::size_t r) noexcept {
+            index_t freed = by_left[l];
+            std::copy(by_left + l + 1, by_left + count, by_left + l);
+            std::copy(by_right + r + 1, by_right + count, by_right + r);
+            count--;
+            std::destroy_at(&items[freed].value);
+            if (freed != count) {
+                new (&items[freed].value) value_type(std::move(items[count].value));
+                std::destroy_at(&items[count].value);
+                by_left[rank(by_left, count)] = freed;
+                by_right[rank(by_right, count)] = freed;
+            }
+        }
+    };
+
+    std::size_t lower_left(Left const& key) const {
+        return small.lower_bound(left_key(), small.by_left, key, left_cmp);
+    }
+
+    std::size_t upper_left(Left const& key) const {
+        return small.upper_bound(left_key(), small.by_left, key, left_cmp);
+    }
+
+    std::size_t lower_right(Right const& key) const {
+        return small.lower_bound(right_key(), small.by_right, key, right_cmp);
+    }
+
+    std::size_t upper_right(Right const& key) const {
+        return small.upper_bound(right_key(), small.by_right, key, right_cmp);
+    }
+
+    // на позиции pos, найденной lower_left, стоит key
+    bool equal_left(std::size_t pos, Left const& key) const {
+        return small.equal(pos, left_key(), small.by_left, key, left_cmp);
+    }
+
+    bool equal_right(std::size_t pos, Right const& key) const {
+        return small.equal(pos, right_key(), small.by_right, key, right_cmp);
+    }
+
+    // O(N log N) strong
+    void promote() {
+        large_type tmp(left_cmp, right_cmp, alloc);
+        for (std::size_t i = 0; i < small.count; i++) {
+            auto const& value = small.items[small.by_left[i]].value;
+            tmp.insert(value.first, value.second);
+        }
+        std::destroy_at(&small);
+        new (&big) large_type(std::move(tmp));
+        large = true;
+    }
+
+    // *this пуст и хранит пары в себе, other остается пустым
+    void take(small_bimap&& other) noexcept {
+        if (other.large) {
+            std::destroy_at(&small);
+            new (&big) large_type(std::move(other.big));
+            large = true;
+        }
+        else {
+            small.move_from(other.small);
+        }
+        other.clear();
+    }
+
+    void destroy() noexcept {
+        if (large) {
+            std::destroy_at(&big);
+            large = false;
+        }
+        else {
+            std::destroy_at(&small);
+        }
+    }
+
+    template <typename Iterator>
+    static auto const& at(Iterator it, Iterator end) {
+        if (it == end) {
+            throw std::out_of_range("");
+        }
+        return *it.flip();
+    }
+
+    [[no_unique_address]] CompareLeft left_cmp;
+    [[no_unique_address]] CompareRight right_cmp;
+    [[no_unique_address]] Allocator alloc;
+    bool large{ false };
+    union {
+        inline_part small;
+        large_type big;
+    };
+};
@@ -0,0 +1,48 @@
+#include "bimap.h"
+#include "check.h"
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace {
+
+using ranked = intrusive::ranked<std::less<int>>;
+using hashed = intrusive::hashed<std::hash<int>>;
+
+// find_*_batch agrees with find_* for present and absent keys, on every
+// kind of side
+template <typename Map>
+void check_batch() {
+    Map m;
+    constexpr int n = 1000;
+    for (int i = 0; i < n; i++) {
+        m.insert(2 * i, -2 * i);
+    }
+    std::vector<int> left, right;
+    for (int i = 0; i < 3 * n; i++) {
+        // every other probe misses, some past either end
+        left.push_back(i - n / 2);
+        right.push_back(n / 2 - i);
+    }
+    std::vector<decltype(m.end_left())> left_out(left.size());
+    std::vector<decltype(m.end_right())> right_out(right.size());
+    m.find_left_batch(left, left_out);
+    m.find_right_batch(right, right_out);
+    for (std::size_t i = 0; i < left.size(); i++) {
+        CHECK(left_out[i] == m.find_left(left[i]));
+        CHECK(right_out[i] == m.find_right(right[i]));
+    }
+    std::vector<int> none;
+    m.find_left_batch(none, std::span(left_out.data(), 0));
+}
+
+} // namespace
+
+int main() {
+    check_batch<bimap<int, int>>();
+    check_batch<bimap<int, int, ranked>>();
+    check_batch<bimap<int, int, std::less<int>, ranked>>();
+    check_batch<bimap<int, int, ranked, ranked>>();
+    check_batch<bimap<int, int, std::less<int>, hashed>>();
+    check_batch<bimap<int, int, hashed, ranked>>();
+}
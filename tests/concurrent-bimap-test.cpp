@@ -0,0 +1,142 @@
+#include "check.h"
+#include "concurrent-bimap.h"
+#include <algorithm> // std::sort
+#include <atomic>
+#include <cstddef>
+#include <random>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Every pair ever inserted is (k, -k), so any view can be checked without
+// knowing which updates it has seen.
+constexpr long keys = 512;
+constexpr int writers = 2;
+constexpr int updates = 10000;
+
+using map = concurrent_bimap<long, long>;
+
+// the pairs of a view in left order, checking what it can on the way
+template <typename View>
+std::vector<long> contents(View const& view) {
+    std::vector<long> res;
+    view.for_each_left([&](long left, long right) {
+        CHECK(right == -left);
+        CHECK(res.empty() || res.back() < left);
+        res.push_back(left);
+        });
+    CHECK(res.size() == view.size());
+    std::size_t count = 0;
+    view.for_each_right([&](long right, long left) {
+        CHECK(right == -left);
+        count++;
+        });
+    CHECK(count == res.size());
+    return res;
+}
+
+// short reads: lookups on one read() view agree with each other
+void read_views(map const& m, std::atomic<bool> const& stop, unsigned seed) {
+    std::mt19937 rng(seed);
+    while (!stop.load()) {
+        auto view = m.read();
+        for (int i = 0; i < 16; i++) {
+            long k = static_cast<long>(rng() % keys);
+            auto p = view.find_left(k);
+            CHECK(view.find_right(-k) == p);
+            if (p != nullptr) {
+                CHECK(p->second == -k);
+                CHECK(view.at_left(k) == -k);
+            }
+            auto lb = view.lower_bound_left(k);
+            CHECK(lb == nullptr || lb->first >= k);
+        }
+        if (rng() % 64 == 0) {
+            contents(view);
+        }
+        // the convenience lookups take a view of their own
+        long k = static_cast<long>(rng() % keys);
+        if (auto right = m.find_left(k)) {
+            CHECK(*right == -k);
+        }
+        // leave the writers some time on machines with few cores
+        std::this_thread::yield();
+    }
+}
+
+// long reads: a snapshot keeps showing the same pairs however long the
+// writers go on
+void snapshots(map const& m, std::atomic<bool> const& stop) {
+    while (!stop.load()) {
+        auto snapshot = m.snapshot();
+        auto before = contents(snapshot);
+        for (int i = 0; i < 4 && !stop.load(); i++) {
+            std::this_thread::yield();
+            CHECK(contents(snapshot) == before);
+        }
+        auto moved = std::move(snapshot);
+        CHECK(contents(moved) == before);
+    }
+}
+
+// writer w owns the keys k % writers == w and reclaims now and then
+std::set<long> write(map& m, int w) {
+    std::mt19937 rng(100 + w);
+    std::set<long> present;
+    for (int i = 0; i < updates; i++) {
+        long k = static_cast<long>(rng() % (keys / writers)) * writers + w;
+        if (rng() % 2 == 0) {
+            CHECK(m.insert(k, -k) == present.insert(k).second);
+        }
+        else {
+            bool erased = rng() % 2 == 0 ? m.erase_left(k) : m.erase_right(-k);
+            CHECK(erased == (present.erase(k) == 1));
+        }
+        if (i % 256 == 0) {
+            m.reclaim();
+        }
+    }
+    return present;
+}
+
+} // namespace
+
+int main() {
+    map m;
+    std::atomic<bool> stop{ false };
+    std::vector<std::thread> readers;
+    for (unsigned i = 0; i < 3; i++) {
+        readers.emplace_back([&, i] { read_views(m, stop, i); });
+    }
+    readers.emplace_back([&] { snapshots(m, stop); });
+
+    // a snapshot taken here and read on another thread after the updates
+    auto initial = m.snapshot();
+    std::vector<std::set<long>> present(writers);
+    std::vector<std::thread> updaters;
+    for (int w = 0; w < writers; w++) {
+        updaters.emplace_back([&, w] { present[w] = write(m, w); });
+    }
+    for (auto& t : updaters) {
+        t.join();
+    }
+    stop = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+    std::thread([snapshot = std::move(initial)] {
+        CHECK(snapshot.empty());
+        }).join();
+
+    std::vector<long> expected;
+    for (auto const& keys : present) {
+        expected.insert(expected.end(), keys.begin(), keys.end());
+    }
+    std::sort(expected.begin(), expected.end());
+    CHECK(contents(m.read()) == expected);
+    CHECK(m.size() == expected.size());
+    m.reclaim();
+}
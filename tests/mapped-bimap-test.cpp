@@ -0,0 +1,171 @@
+#include "check.h"
+#include "mapped-bimap.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+using mapped::index_t;
+
+// write_image output copied into a buffer with the 64-byte alignment
+// mapped_bimap requires
+struct image {
+    template <typename Frozen>
+    explicit image(Frozen const& f) {
+        std::stringstream out;
+        write_image(f, out);
+        auto bytes = out.str();
+        buffer.resize(bytes.size() + mapped::section_align);
+        auto addr = reinterpret_cast<std::uintptr_t>(buffer.data());
+        data = buffer.data() + (mapped::align_up(addr) - addr);
+        size = bytes.size();
+        std::memcpy(data, bytes.data(), size);
+    }
+
+    std::span<std::byte const> bytes() const {
+        return { data, size };
+    }
+
+    mapped::header header() const {
+        mapped::header h;
+        std::memcpy(&h, data, sizeof(h));
+        return h;
+    }
+
+    template <typename T>
+    void put(std::uint64_t offset, T value) {
+        std::memcpy(data + offset, &value, sizeof(value));
+    }
+
+    std::vector<std::byte> buffer;
+    std::byte* data;
+    std::size_t size;
+};
+
+template <typename Frozen, typename Mapped>
+void check_same(Frozen const& f, Mapped const& m) {
+    CHECK(m.size() == f.size());
+    auto fi = f.begin_left();
+    for (auto mi = m.begin_left(); mi != m.end_left(); ++mi, ++fi) {
+        CHECK(*mi == *fi);
+        CHECK(*mi.flip() == *fi.flip());
+        CHECK(m.find_left(*fi) == mi);
+        CHECK(m.find_right(*fi.flip()).flip() == mi);
+    }
+    CHECK(fi == f.end_left());
+    auto fr = f.begin_right();
+    for (auto mr = m.begin_right(); mr != m.end_right(); ++mr, ++fr) {
+        CHECK(*mr == *fr);
+    }
+    CHECK(m.end_left().flip() == m.end_right());
+}
+
+template <typename Mapped>
+bool rejects(image const& img) {
+    try {
+        Mapped m(img.bytes());
+        m.validate();
+    }
+    catch (std::invalid_argument const&) {
+        return true;
+    }
+    return false;
+}
+
+void round_trip() {
+    bimap<int, std::uint64_t> source;
+    for (int i = 0; i < 5000; i++) {
+        source.insert(i * 7919 % 10007 - 5000, std::uint64_t(i) * 0x9e3779b97f4a7c15ull);
+    }
+    frozen_bimap<int, std::uint64_t> f(source);
+    image img(f);
+    mapped_bimap<int, std::uint64_t> m(img.bytes());
+    m.validate();
+    check_same(f, m);
+    for (int key = -5010; key < 5020; key += 3) {
+        CHECK(m.lower_bound_left(key) - m.begin_left() ==
+            f.lower_bound_left(key) - f.begin_left());
+        CHECK((m.find_left(key) == m.end_left()) == (f.find_left(key) == f.end_left()));
+    }
+
+    frozen_bimap<int, std::uint64_t> empty;
+    image empty_img(empty);
+    mapped_bimap<int, std::uint64_t> e(empty_img.bytes());
+    e.validate();
+    CHECK(e.empty() && e.begin_right() == e.end_right());
+}
+
+void round_trip_strings() {
+    bimap<std::string, std::string> source;
+    for (int i = 0; i < 2000; i++) {
+        source.insert("left:" + std::to_string(i * 7919 % 10007), "r" + std::to_string(i));
+    }
+    source.insert("", "empty");
+    frozen_bimap<std::string, std::string> f(source);
+    image img(f);
+    mapped_bimap<std::string, std::string> m(img.bytes());
+    m.validate();
+    check_same(f, m);
+    CHECK(m.at_right("empty").empty());
+    CHECK(m.find_left("left:none") == m.end_left());
+}
+
+void corrupted_body() {
+    using map = mapped_bimap<std::string, int>;
+    bimap<std::string, int> source;
+    for (int i = 0; i < 100; i++) {
+        source.insert("key" + std::to_string(i), 100 - i);
+    }
+    frozen_bimap<std::string, int> f(source);
+    image const good(f);
+    auto h = good.header();
+    CHECK(!rejects<map>(good));
+
+    // right_order pointing past the pairs
+    image order(f);
+    order.put(h.order_offset + 3 * sizeof(index_t), index_t(h.count + 5));
+    CHECK(rejects<map>(order));
+
+    // in range, but right_rank no longer inverts right_order
+    image rank(f);
+    rank.put(h.rank_offset, index_t(1));
+    CHECK(rejects<map>(rank));
+
+    // sentinel entry
+    image sentinel(f);
+    sentinel.put(h.order_offset + h.count * sizeof(index_t), index_t(0));
+    CHECK(rejects<map>(sentinel));
+
+    // a string reaching past the string area, and one whose offset plus
+    // size wraps around
+    image past(f);
+    past.put(h.left_offset + 7 * sizeof(mapped::string_ref),
+        mapped::string_ref{ h.strings_size - 2, 3 });
+    CHECK(rejects<map>(past));
+    image wrap(f);
+    wrap.put(h.left_offset, mapped::string_ref{ 1, ~std::uint64_t(0) });
+    CHECK(rejects<map>(wrap));
+
+    // truncated and mistyped images fail already in the constructor
+    CHECK(rejects<map>(image(frozen_bimap<std::string, long>())));
+    try {
+        map m(good.bytes().first(good.size - 1));
+        CHECK(false);
+    }
+    catch (std::invalid_argument const&) {
+    }
+}
+
+} // namespace
+
+int main() {
+    round_trip();
+    round_trip_strings();
+    corrupted_body();
+}
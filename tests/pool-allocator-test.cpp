@@ -0,0 +1,70 @@
+#include "bimap.h"
+#include "check.h"
+#include "pool-allocator.h"
+#include <cstddef>
+#include <functional>
+#include <new>
+
+// Aligned operator new is what node_pool uses for its slabs and for
+// anything it refuses to pool, so counting it counts pool misses.
+namespace {
+std::size_t aligned_news = 0;
+std::size_t aligned_deletes = 0;
+} // namespace
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    aligned_news++;
+    auto a = static_cast<std::size_t>(align);
+    if (void* p = std::aligned_alloc(a, (size + a - 1) / a * a)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    if (ptr != nullptr) {
+        aligned_deletes++;
+    }
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t align) noexcept {
+    operator delete(ptr, align);
+}
+
+namespace {
+
+template <typename Map>
+std::size_t fill_and_clear(std::size_t n) {
+    Map m;
+    auto before = aligned_news;
+    for (std::size_t i = 0; i < n; i++) {
+        m.insert(static_cast<int>(i), -static_cast<int>(i));
+    }
+    auto used = aligned_news - before;
+    auto freed = aligned_deletes;
+    m.clear();
+    // trivially destructible keys: clear() hands back the whole pool, which
+    // only works if nothing else, such as the buckets, shares it
+    CHECK(aligned_deletes - freed == used);
+    return used;
+}
+
+using pool = pool_allocator<std::pair<int, int>>;
+using hashed = intrusive::hashed<std::hash<int>>;
+
+} // namespace
+
+int main() {
+    constexpr std::size_t n = 1000;
+    auto ordered = fill_and_clear<bimap<int, int, std::less<int>,
+        std::less<int>, pool>>(n);
+    auto hashed_left = fill_and_clear<bimap<int, int, hashed,
+        std::less<int>, pool>>(n);
+    auto hashed_right = fill_and_clear<bimap<int, int, std::less<int>,
+        hashed, pool>>(n);
+    // a handful of slabs, no node outside the pool
+    CHECK(ordered < 16);
+    CHECK(hashed_left == ordered);
+    CHECK(hashed_right == ordered);
+}